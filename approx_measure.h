@@ -0,0 +1,390 @@
+#ifndef IMPOSSIBLE_PROGRAMS_APPROX_MEASURE_H
+#define IMPOSSIBLE_PROGRAMS_APPROX_MEASURE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <optional>
+#include <random>
+#include <vector>
+
+#include "impossible.h"
+#include "utils.h"
+
+// Approximate measures, for predicates whose decision trees are too big for
+// Measure to walk.
+//
+// ApproxMeasure is ApproxMC (Chakraborty, Meel and Vardi) on Cantor space.
+// The predicate may only read bits below some n, so its measure is the number
+// of its solutions over those n bits divided by 2^n.  Each round draws m
+// random XOR constraints over the n bits, each of which a given solution
+// satisfies with probability 1/2, independently for any two solutions, and
+// counts the solutions that satisfy all of them with a tree walk that stops
+// once it has seen `threshold` of them.  The smallest m that leaves fewer than
+// `threshold` gives the estimate count * 2^m, and the median over the rounds
+// is within a factor of 1 + epsilon of the true count with probability at
+// least 1 - delta.
+//
+// The walk prunes a branch as soon as the bits read on it violate a
+// constraint, so the constraints cut the tree it walks as well as the count.
+
+// A system of XOR constraints over the bits [0, `variable_count`): each says
+// that the XOR of some of the bits is a given value.
+class XorSystem {
+public:
+  // `row_count` random constraints, each over every bit with probability 1/2
+  // and with a random value.  All of them are active.
+  XorSystem(Natural variable_count, int row_count, std::mt19937_64 *rng)
+      : variable_count_(variable_count), words_((variable_count + 63) / 64) {
+    for (int r = 0; r < row_count; r++) {
+      Row row{std::vector<uint64_t>(words_), static_cast<Bit>((*rng)() & 1)};
+      for (uint64_t &word : row.bits) {
+        word = (*rng)();
+      }
+      if (variable_count % 64) {
+        row.bits.back() &= (1ull << (variable_count % 64)) - 1;
+      }
+      rows_.push_back(std::move(row));
+    }
+    SetActiveRows(row_count);
+  }
+
+  // Only the first `count` constraints apply from now on, so that a system
+  // with more active constraints is a subset of one with fewer.
+  void SetActiveRows(int count) {
+    active_rows_ = count;
+    reduced_.clear();
+    consistent_ =
+        Reduce(std::vector<Row>(rows_.begin(), rows_.begin() + count),
+               &reduced_);
+    constraints_of_bit_.assign(variable_count_, {});
+    for (size_t r = 0; r < reduced_.size(); r++) {
+      for (Natural idx = 0; idx < variable_count_; idx++) {
+        if (Has(reduced_[r], idx)) {
+          constraints_of_bit_[idx].push_back(r);
+        }
+      }
+    }
+  }
+
+  Natural variable_count() const { return variable_count_; }
+  int active_rows() const { return active_rows_; }
+
+  // Log2 of the number of assignments to the bits [0, `variable_count`) that
+  // satisfy the active constraints and agree with `fixed`, or nothing if
+  // there are none.  `fixed` may repeat a bit, but only with the same value.
+  std::optional<Natural> FreeDimension(const Cylinder &fixed) const {
+    if (!consistent_) {
+      return std::nullopt;
+    }
+
+    std::vector<uint64_t> mask(words_), values(words_);
+    Natural fixed_count = 0;
+    for (const auto &[idx, value] : fixed.bits) {
+      uint64_t bit = 1ull << (idx % 64);
+      fixed_count += !(mask[idx / 64] & bit);
+      mask[idx / 64] |= bit;
+      values[idx / 64] |= value ? bit : 0;
+    }
+
+    std::vector<Row> substituted;
+    for (const Row &row : reduced_) {
+      Row free{std::vector<uint64_t>(words_), row.rhs};
+      for (size_t w = 0; w < words_; w++) {
+        free.rhs ^= __builtin_parityll(row.bits[w] & values[w]);
+        free.bits[w] = row.bits[w] & ~mask[w];
+      }
+      substituted.push_back(std::move(free));
+    }
+    std::vector<Row> independent;
+    if (!Reduce(std::move(substituted), &independent)) {
+      return std::nullopt;
+    }
+    return variable_count_ - fixed_count - independent.size();
+  }
+
+  // The active constraints in reduced row echelon form, which have the same
+  // solutions, and the ones that mention bit `idx`.
+  size_t reduced_row_count() const { return reduced_.size(); }
+  const std::vector<size_t> &ConstraintsOfBit(Natural idx) const {
+    return constraints_of_bit_[idx];
+  }
+  int64_t BitCount(size_t r) const {
+    int64_t count = 0;
+    for (uint64_t word : reduced_[r].bits) {
+      count += __builtin_popcountll(word);
+    }
+    return count;
+  }
+  Bit Value(size_t r) const { return reduced_[r].rhs; }
+
+  // False if the active constraints have no solution at all.
+  bool consistent() const { return consistent_; }
+
+private:
+  struct Row {
+    std::vector<uint64_t> bits;
+    Bit rhs;
+  };
+
+  static bool Has(const Row &row, Natural idx) {
+    return (row.bits[idx / 64] >> (idx % 64)) & 1;
+  }
+
+  // Gaussian elimination: sets `reduced` to independent rows in reduced row
+  // echelon form with the same solutions as `rows`, each pivoting on its
+  // highest bit.  Returns false if `rows` has no solution.
+  static bool Reduce(std::vector<Row> rows, std::vector<Row> *reduced) {
+    std::vector<Natural> pivots;
+    for (Row &row : rows) {
+      for (size_t p = 0; p < reduced->size(); p++) {
+        if (Has(row, pivots[p])) {
+          XorInto(&row, (*reduced)[p]);
+        }
+      }
+
+      std::optional<Natural> pivot = HighestBit(row);
+      if (!pivot) {
+        if (row.rhs) {
+          return false;
+        }
+        continue;
+      }
+      for (Row &other : *reduced) {
+        if (Has(other, *pivot)) {
+          XorInto(&other, row);
+        }
+      }
+      reduced->push_back(std::move(row));
+      pivots.push_back(*pivot);
+    }
+    return true;
+  }
+
+  static void XorInto(Row *row, const Row &other) {
+    for (size_t w = 0; w < row->bits.size(); w++) {
+      row->bits[w] ^= other.bits[w];
+    }
+    row->rhs ^= other.rhs;
+  }
+
+  static std::optional<Natural> HighestBit(const Row &row) {
+    for (size_t w = row.bits.size(); w > 0; w--) {
+      if (row.bits[w - 1]) {
+        return (w - 1) * 64 + 63 - __builtin_clzll(row.bits[w - 1]);
+      }
+    }
+    return std::nullopt;
+  }
+
+  Natural variable_count_;
+  size_t words_;
+  std::vector<Row> rows_;
+  int active_rows_ = 0;
+  bool consistent_ = true;
+  std::vector<Row> reduced_;
+  std::vector<std::vector<size_t>> constraints_of_bit_;
+};
+
+// A view of `source` that keeps track of the bits read through it and
+// returns the sentinel, marking the evaluation as pruned, as soon as they
+// violate one of `system`'s constraints.  Reading a bit past
+// `system->variable_count()` is an error.
+class XorPruningBitSequence : public BitSequence {
+public:
+  XorPruningBitSequence(BitSequence *source, const XorSystem *system)
+      : source_(source), system_(*system),
+        unread_(system->reduced_row_count()),
+        parity_(system->reduced_row_count()),
+        read_(system->variable_count()) {
+    for (size_t r = 0; r < unread_.size(); r++) {
+      unread_[r] = system_.BitCount(r);
+    }
+  }
+  virtual ~XorPruningBitSequence() override {}
+
+  std::optional<Bit> Get(Natural idx) override {
+    if (idx >= system_.variable_count()) {
+      printf("Predicate read bit %llu, past ApproxMeasureOptions::"
+             "index_range!\n",
+             static_cast<unsigned long long>(idx));
+      abort();
+    }
+    ASSIGN_OR_RETURN(Bit, bit, source_->Get(idx));
+    if (read_[idx]) {
+      return bit;
+    }
+
+    read_[idx] = true;
+    for (size_t r : system_.ConstraintsOfBit(idx)) {
+      parity_[r] = parity_[r] != bit;
+      if (--unread_[r] == 0 && parity_[r] != system_.Value(r)) {
+        pruned_ = true;
+        return std::nullopt;
+      }
+    }
+    return bit;
+  }
+
+  bool pruned() const { return pruned_; }
+
+private:
+  BitSequence *source_;
+  const XorSystem &system_;
+  std::vector<int64_t> unread_;
+  std::vector<Bit> parity_;
+  std::vector<bool> read_;
+  bool pruned_ = false;
+};
+
+// The number of assignments to the bits [0, `system.variable_count()`) on
+// which both `predicate` and `system` hold, or some number at least
+// `threshold` if there are that many.
+template <typename PredicateTy>
+double CountSolutionsUpTo(const PredicateTy &predicate,
+                          const XorSystem &system, double threshold) {
+  if (!system.consistent()) {
+    return 0;
+  }
+
+  SearchStatsRecorder stats;
+  TRACE_EVENT(kSearchBegin, 0);
+  auto pruned_predicate = [&](BitSequence *sequence) -> std::optional<Bit> {
+    XorPruningBitSequence pruning(sequence, &system);
+    std::optional<Bit> result = predicate(&pruning);
+    if (pruning.pruned()) {
+      return false;
+    }
+    return result;
+  };
+  DecisionTreeWalker<Bit, decltype(pruned_predicate)> walker(
+      pruned_predicate);
+  double count = 0;
+  Cylinder leaf;
+  while (count < threshold && walker.Next()) {
+    if (!walker.value()) {
+      continue;
+    }
+    leaf.bits.clear();
+    for (const auto &decision : walker.path()) {
+      leaf.bits.emplace_back(decision.index, decision.value);
+    }
+    std::optional<Natural> dimension = system.FreeDimension(leaf);
+    if (dimension) {
+      count += std::ldexp(1.0, static_cast<int>(*dimension));
+    }
+  }
+  SearchStats walk_stats = walker.stats();
+  walk_stats.searches = 0;
+  stats->Add(walk_stats);
+  TRACE_EVENT(kSearchEnd, count > 0);
+  return count;
+}
+
+struct ApproxMeasureOptions {
+  // The predicate may only read bits below this.
+  Natural index_range = 64;
+
+  // The estimate is within a factor of 1 + `epsilon` of the measure with
+  // probability at least 1 - `delta`.
+  double epsilon = 0.8;
+  double delta = 0.2;
+
+  uint64_t seed = 1;
+};
+
+struct MeasureEstimate {
+  double measure = 0;
+
+  // The interval the guarantee puts the measure in.  Equal to `measure` if
+  // it is exact.
+  double low = 0;
+  double high = 1;
+
+  // Whether there were few enough solutions to count them all, in which case
+  // `measure` is exact.
+  bool exact = false;
+
+  // Rounds of random constraints, and how many of them found a usable
+  // number of constraints.
+  int rounds = 0;
+  int successful_rounds = 0;
+
+  SearchStats stats;
+};
+
+// Fills in `estimate` for ApproxMeasure, apart from its stats.
+template <typename PredicateTy>
+void ApproxMeasureImpl(const PredicateTy &predicate,
+                       const ApproxMeasureOptions &options,
+                       MeasureEstimate *estimate) {
+  double epsilon = options.epsilon;
+  double threshold =
+      std::ceil(1 + 9.84 * (1 + epsilon / (1 + epsilon)) *
+                        (1 + 1 / epsilon) * (1 + 1 / epsilon));
+  Natural n = options.index_range;
+  std::mt19937_64 rng(options.seed);
+  double scale = std::ldexp(1.0, -static_cast<int>(n));
+
+  XorSystem unconstrained(n, 0, &rng);
+  double count = CountSolutionsUpTo(predicate, unconstrained, threshold);
+  if (count < threshold) {
+    estimate->measure = estimate->low = estimate->high = count * scale;
+    estimate->exact = true;
+    return;
+  }
+
+  // The constraints of a round are nested, so the count only goes down as
+  // more of them are added, and the smallest number of constraints leaving
+  // fewer than `threshold` solutions can be found by bisection.
+  estimate->rounds = std::ceil(17 * std::log2(3 / options.delta));
+  std::vector<double> estimates;
+  for (int round = 0; round < estimate->rounds; round++) {
+    XorSystem system(n, n, &rng);
+    if (CountSolutionsUpTo(predicate, system, threshold) >= threshold) {
+      continue;
+    }
+    int low = 1, high = n;
+    while (low < high) {
+      int mid = low + (high - low) / 2;
+      system.SetActiveRows(mid);
+      if (CountSolutionsUpTo(predicate, system, threshold) < threshold) {
+        high = mid;
+      } else {
+        low = mid + 1;
+      }
+    }
+    system.SetActiveRows(low);
+    estimates.push_back(CountSolutionsUpTo(predicate, system, threshold) *
+                        std::ldexp(1.0, low));
+  }
+
+  estimate->successful_rounds = estimates.size();
+  if (estimates.empty()) {
+    return;
+  }
+  std::nth_element(estimates.begin(), estimates.begin() + estimates.size() / 2,
+                   estimates.end());
+  estimate->measure = estimates[estimates.size() / 2] * scale;
+  estimate->low = estimate->measure / (1 + epsilon);
+  estimate->high = std::min(estimate->measure * (1 + epsilon), 1.0);
+}
+
+// Estimates Measure(`predicate`), see the top of this file.  If no round
+// succeeds, which happens with negligible probability, the estimate is 0
+// within [0, 1].
+template <typename PredicateTy>
+MeasureEstimate ApproxMeasure(PredicateTy predicate,
+                              const ApproxMeasureOptions &options) {
+  PROFILE_COUNTED_SCOPE("ApproxMeasure");
+  MeasureEstimate estimate;
+  {
+    CollectSearchStats collect(&estimate.stats);
+    ApproxMeasureImpl(predicate, options, &estimate);
+  }
+  return estimate;
+}
+
+#endif
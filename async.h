@@ -0,0 +1,176 @@
+#ifndef IMPOSSIBLE_PROGRAMS_ASYNC_H
+#define IMPOSSIBLE_PROGRAMS_ASYNC_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "impossible.h"
+
+// Asynchronous versions of the bounded quantifiers.
+//
+// ForSomeAsync, EqualAsync and ModulusAsync queue the search on an Executor,
+// by default the one shared by the whole process, and return a SearchFuture
+// for its result.  Every search gets its own CancellationToken, which
+// SearchFuture::Cancel trips, and so does dropping the future: a search whose
+// result nobody can read any more stops at its next budget check.  Searches
+// are independent of each other, since the engines keep all their state per
+// thread, so any number of them can run at once.
+
+// A fixed set of worker threads running tasks in the order they were
+// submitted.
+class Executor {
+public:
+  explicit Executor(int thread_count) {
+    for (int i = 0; i < thread_count; i++) {
+      threads_.emplace_back([this] { Work(); });
+    }
+  }
+
+  Executor(const Executor &) = delete;
+  Executor &operator=(const Executor &) = delete;
+
+  // Runs the tasks still queued, then joins the workers.
+  ~Executor() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    task_available_.notify_all();
+    for (std::thread &thread : threads_) {
+      thread.join();
+    }
+  }
+
+  void Submit(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      tasks_.push_back(std::move(task));
+    }
+    task_available_.notify_one();
+  }
+
+  int thread_count() const { return threads_.size(); }
+
+  // The executor the async quantifiers use by default, with a thread per
+  // core.
+  static Executor *Shared() {
+    static Executor executor(
+        std::max<int>(std::thread::hardware_concurrency(), 1));
+    return &executor;
+  }
+
+private:
+  void Work() {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        task_available_.wait(lock,
+                             [this] { return stopping_ || !tasks_.empty(); });
+        if (tasks_.empty()) {
+          return;
+        }
+        task = std::move(tasks_.front());
+        tasks_.pop_front();
+      }
+      task();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable task_available_;
+  std::deque<std::function<void()>> tasks_;
+  bool stopping_ = false;
+  std::vector<std::thread> threads_;
+};
+
+// The result of an asynchronous search.  Dropping it cancels the search.
+template <typename T> class SearchFuture {
+public:
+  SearchFuture(std::future<T> future,
+               std::shared_ptr<CancellationToken> cancellation)
+      : future_(std::move(future)), cancellation_(std::move(cancellation)) {}
+
+  SearchFuture(SearchFuture &&) = default;
+  SearchFuture &operator=(SearchFuture &&) = delete;
+
+  ~SearchFuture() { Cancel(); }
+
+  // Asks the search to stop.  Its result will be unknown unless it finished
+  // first.
+  void Cancel() {
+    if (cancellation_) {
+      cancellation_->Cancel();
+    }
+  }
+
+  bool IsReady() const {
+    return future_.wait_for(std::chrono::seconds(0)) ==
+           std::future_status::ready;
+  }
+
+  // Waits for the search to finish and returns its result.  Can only be
+  // called once.
+  T Get() { return future_.get(); }
+
+private:
+  std::future<T> future_;
+  std::shared_ptr<CancellationToken> cancellation_;
+};
+
+// Queues `fn(budget)` on `executor`, with `budget` extended by the
+// cancellation token of the returned future.
+template <typename T, typename FnTy>
+SearchFuture<T> RunAsync(Executor *executor, SearchBudget budget, FnTy fn) {
+  auto cancellation = std::make_shared<CancellationToken>(budget.cancellation);
+  auto promise = std::make_shared<std::promise<T>>();
+  SearchFuture<T> future(promise->get_future(), cancellation);
+  budget.cancellation = cancellation.get();
+  executor->Submit([promise, cancellation, budget, fn] {
+    promise->set_value(fn(budget));
+  });
+  return future;
+}
+
+// `budget`'s own cancellation token, if any, is honoured too and must outlive
+// the search.
+template <typename PredicateTy>
+SearchFuture<BoundedTruth>
+ForSomeAsync(PredicateTy predicate, SearchBudget budget = SearchBudget(),
+             Executor *executor = Executor::Shared()) {
+  return RunAsync<BoundedTruth>(
+      executor, budget,
+      [predicate](const SearchBudget &budget) {
+        return ForSome(predicate, budget);
+      });
+}
+
+template <typename T, typename PredicateTy>
+SearchFuture<BoundedTruth>
+EqualAsync(PredicateTy f_a, PredicateTy f_b,
+           SearchBudget budget = SearchBudget(),
+           Executor *executor = Executor::Shared()) {
+  return RunAsync<BoundedTruth>(
+      executor, budget, [f_a, f_b](const SearchBudget &budget) {
+        return Equal<T>(f_a, f_b, budget);
+      });
+}
+
+template <typename T, typename PredicateTy>
+SearchFuture<BoundedNatural>
+ModulusAsync(PredicateTy fn, SearchBudget budget = SearchBudget(),
+             Executor *executor = Executor::Shared()) {
+  return RunAsync<BoundedNatural>(
+      executor, budget,
+      [fn](const SearchBudget &budget) { return Modulus<T>(fn, budget); });
+}
+
+#endif
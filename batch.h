@@ -0,0 +1,281 @@
+#ifndef IMPOSSIBLE_PROGRAMS_BATCH_H
+#define IMPOSSIBLE_PROGRAMS_BATCH_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "async.h"
+#include "impossible.h"
+
+// Runs batches of independent named checks across an Executor's threads.
+//
+// Checks are started longest-expected-first, the classic greedy schedule for
+// independent jobs on identical machines, so that one long check started
+// last does not leave every other thread idle while it finishes.  A check's
+// expected cost is how long it took last time, if a CheckHistory says so,
+// and otherwise comes from EstimateSearchCost on its predicate.  Checks with
+// neither, like a Modulus that has never run, are started first, since they
+// are the ones that might take arbitrarily long.
+//
+// Results come back in the order the checks were given, whatever order they
+// ran in.
+
+struct CheckResult {
+  // The answer of a ForSome or Equal check.
+  Truth truth = Truth::kUnknown;
+
+  // The answer of a Modulus check, if it finished.
+  std::optional<Natural> value;
+
+  // Includes the check's wall and CPU time.
+  SearchStats stats;
+};
+
+struct Check {
+  std::string name;
+
+  // Runs the check within `budget`.
+  std::function<CheckResult(const SearchBudget &budget)> run;
+
+  // Estimates the number of predicate evaluations the check makes, or
+  // returns a negative number if it has no idea.
+  std::function<double()> estimate_evaluations;
+};
+
+template <typename PredicateTy>
+Check MakeForSomeCheck(std::string name, PredicateTy predicate) {
+  Check check;
+  check.name = std::move(name);
+  check.run = [predicate](const SearchBudget &budget) {
+    CheckResult result;
+    BoundedTruth bounded = ForSome(predicate, budget);
+    result.truth = bounded.truth;
+    result.stats = bounded.stats;
+    return result;
+  };
+  check.estimate_evaluations = [predicate] {
+    return EstimateSearchCost(predicate, /*probes=*/16, /*seed=*/1)
+        .evaluations;
+  };
+  return check;
+}
+
+template <typename T, typename PredicateTy>
+Check MakeEqualCheck(std::string name, PredicateTy f_a, PredicateTy f_b) {
+  Check check;
+  check.name = std::move(name);
+  check.run = [f_a, f_b](const SearchBudget &budget) {
+    CheckResult result;
+    BoundedTruth bounded = Equal<T>(f_a, f_b, budget);
+    result.truth = bounded.truth;
+    result.stats = bounded.stats;
+    return result;
+  };
+  check.estimate_evaluations = [f_a, f_b] {
+    return EstimateSearchCost(AgreeOn<T>(f_a, f_b), /*probes=*/16,
+                              /*seed=*/1)
+        .evaluations;
+  };
+  return check;
+}
+
+// Modulus makes a search per candidate modulus, so there is no single tree
+// to estimate.
+template <typename T, typename PredicateTy>
+Check MakeModulusCheck(std::string name, PredicateTy fn) {
+  Check check;
+  check.name = std::move(name);
+  check.run = [fn](const SearchBudget &budget) {
+    CheckResult result;
+    BoundedNatural bounded = Modulus<T>(fn, budget);
+    result.truth = bounded.value ? Truth::kTrue : Truth::kUnknown;
+    result.value = bounded.value;
+    result.stats = bounded.stats;
+    return result;
+  };
+  check.estimate_evaluations = [] { return -1.0; };
+  return check;
+}
+
+// How long checks took the last time they ran, by name.  Saved as lines of
+// `<wall time in ns> <name>`.
+class CheckHistory {
+public:
+  void Record(const std::string &name, const CheckResult &result) {
+    wall_time_ns_[name] = result.stats.wall_time_ns;
+  }
+
+  std::optional<int64_t> WallTimeNs(const std::string &name) const {
+    auto it = wall_time_ns_.find(name);
+    if (it == wall_time_ns_.end()) {
+      return std::nullopt;
+    }
+    return it->second;
+  }
+
+  // Returns false if `in` does not hold a saved history.
+  bool Load(FILE *in) {
+    long long ns;
+    char name[4096];
+    while (fscanf(in, "%lld %4095[^\n]", &ns, name) == 2) {
+      wall_time_ns_[name] = ns;
+    }
+    return feof(in) && !ferror(in);
+  }
+
+  bool Save(FILE *out) const {
+    for (const auto &[name, ns] : wall_time_ns_) {
+      fprintf(out, "%lld %s\n", static_cast<long long>(ns), name.c_str());
+    }
+    return !ferror(out);
+  }
+
+private:
+  std::map<std::string, int64_t> wall_time_ns_;
+};
+
+struct BatchOptions {
+  Executor *executor = Executor::Shared();
+
+  // Applies to each check separately.
+  SearchBudget budget;
+
+  // If set, used to order the checks and updated with their times.
+  CheckHistory *history = nullptr;
+
+  // Converts estimated evaluations to time, so that estimates can be ordered
+  // against times from the history.
+  double ns_per_evaluation = 50;
+};
+
+struct BatchReport {
+  // In the order of the checks.
+  std::vector<CheckResult> results;
+
+  // Expected cost of each check in ns, or -1 if unknown, and the order the
+  // checks were started in.
+  std::vector<double> expected_ns;
+  std::vector<size_t> start_order;
+
+  int64_t wall_time_ns = 0;
+};
+
+inline BatchReport RunBatch(const std::vector<Check> &checks,
+                            const BatchOptions &options) {
+  auto start = std::chrono::steady_clock::now();
+  BatchReport report;
+  for (const Check &check : checks) {
+    std::optional<int64_t> ns;
+    if (options.history) {
+      ns = options.history->WallTimeNs(check.name);
+    }
+    if (ns) {
+      report.expected_ns.push_back(*ns);
+      continue;
+    }
+    double evaluations = check.estimate_evaluations();
+    report.expected_ns.push_back(
+        evaluations < 0 ? -1 : evaluations * options.ns_per_evaluation);
+  }
+
+  // Unknown costs first, then longest expected first.  Ties keep the order
+  // the checks were given in.
+  report.start_order.resize(checks.size());
+  std::iota(report.start_order.begin(), report.start_order.end(), 0);
+  auto sort_key = [&](size_t i) {
+    return report.expected_ns[i] < 0 ? INFINITY : report.expected_ns[i];
+  };
+  std::stable_sort(
+      report.start_order.begin(), report.start_order.end(),
+      [&](size_t a, size_t b) { return sort_key(a) > sort_key(b); });
+
+  // Every task runs the next check not started yet, so that the calling
+  // thread can run checks too while it waits.  A RunBatch called from one of
+  // the executor's own threads then never waits on checks that no free
+  // thread is left to run, and never runs anyone else's work.
+  struct Queue {
+    std::vector<const Check *> checks;
+    std::vector<std::promise<CheckResult>> promises;
+    std::atomic<size_t> next{0};
+    SearchBudget budget;
+
+    // Returns false once every check has been started.
+    bool RunNext() {
+      size_t i = next.fetch_add(1, std::memory_order_relaxed);
+      if (i >= checks.size()) {
+        return false;
+      }
+      promises[i].set_value(checks[i]->run(budget));
+      return true;
+    }
+  };
+  auto queue = std::make_shared<Queue>();
+  queue->budget = options.budget;
+  queue->promises.resize(checks.size());
+  std::vector<std::future<CheckResult>> futures(checks.size());
+  for (size_t i : report.start_order) {
+    futures[i] = queue->promises[queue->checks.size()].get_future();
+    queue->checks.push_back(&checks[i]);
+  }
+  for (size_t i = 0; i < checks.size(); i++) {
+    options.executor->Submit([queue] { queue->RunNext(); });
+  }
+
+  {
+    // The checks run here must not see the caller's stats scopes, search
+    // frames and profile scopes, as they would not on a worker.
+    CollectSearchStats::Detached detached_stats;
+    SearchFrame::Detached detached_frames;
+    Profiler::Detached detached_profile;
+    while (queue->RunNext()) {
+    }
+  }
+
+  for (size_t i = 0; i < checks.size(); i++) {
+    report.results.push_back(futures[i].get());
+    if (options.history) {
+      options.history->Record(checks[i].name, report.results.back());
+    }
+  }
+  report.wall_time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
+  return report;
+}
+
+// Prints each check's result and time in the order of the checks, then the
+// time of the whole batch.
+inline void PrintBatchReport(FILE *out, const std::vector<Check> &checks,
+                             const BatchReport &report) {
+  int64_t total_check_ns = 0;
+  for (size_t i = 0; i < checks.size(); i++) {
+    const CheckResult &result = report.results[i];
+    char answer[32];
+    if (result.value) {
+      snprintf(answer, sizeof(answer), "%llu",
+               static_cast<unsigned long long>(*result.value));
+    } else {
+      snprintf(answer, sizeof(answer), "%s", TruthName(result.truth));
+    }
+    fprintf(out, "%-50s %12s %12.3lfms\n", checks[i].name.c_str(), answer,
+            result.stats.wall_time_ns / 1e6);
+    total_check_ns += result.stats.wall_time_ns;
+  }
+  fprintf(out, "%zu checks in %.3lfms, %.3lfms of checks\n", checks.size(),
+          report.wall_time_ns / 1e6, total_check_ns / 1e6);
+}
+
+#endif
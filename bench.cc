@@ -0,0 +1,183 @@
+// End-to-end benchmarks of the search engines and the quantifiers built on
+// them, over families of predicates parameterized by size.  An operation is
+// one top-level search.
+//
+// Usage: bench [--warmup=N] [--repetitions=N] [--min_time_ms=N]
+//              [--filter=SUBSTRING] [--json=PATH] [--baseline=PATH]
+//              [--significance_level=P]
+
+#include <cstdio>
+#include <initializer_list>
+#include <optional>
+#include <string>
+
+#include "bench.h"
+#include "impossible.h"
+#include "profiler.h"
+#include "random_predicate.h"
+#include "utils.h"
+
+// Reads bits 0, 1, ... up to `k` - 1 and stops at the first zero.  True iff
+// all of them are one.
+auto Prefix(Natural k) {
+  return [k](BitSequence *a) -> std::optional<Bit> {
+    for (Natural i = 0; i < k; i++) {
+      ASSIGN_OR_RETURN(Bit, bit, a->Get(i));
+      if (!bit) {
+        return false;
+      }
+    }
+    return true;
+  };
+}
+
+// Reads `depth` bits, each at an index chosen by the bits before it: the
+// indices form a complete binary tree laid out like a heap, so the predicate
+// can read any of 2^`depth` - 1 indices.  Returns `on_all_ones` if every bit
+// read was one and false otherwise.
+auto AdaptiveChain(Natural depth, Bit on_all_ones) {
+  return [depth, on_all_ones](BitSequence *a) -> std::optional<Bit> {
+    Natural idx = 0;
+    bool all_ones = true;
+    for (Natural i = 0; i < depth; i++) {
+      ASSIGN_OR_RETURN(Bit, bit, a->Get(idx));
+      all_ones &= bit;
+      idx = 2 * idx + 1 + bit;
+    }
+    return all_ones && on_all_ones;
+  };
+}
+
+// Reads all of bits 0 to `width` - 1 before deciding anything, so no flip
+// ever misses its footprint.  True iff all of them are one.
+auto Wide(Natural width) {
+  return [width](BitSequence *a) -> std::optional<Bit> {
+    Natural ones = 0;
+    for (Natural i = 0; i < width; i++) {
+      ASSIGN_OR_RETURN(Bit, bit, a->Get(i));
+      ones += bit;
+    }
+    return ones == width;
+  };
+}
+
+// Like Prefix(8), but reads bits `spacing` apart.
+auto FarIndices(Natural spacing) {
+  return [spacing](BitSequence *a) -> std::optional<Bit> {
+    for (Natural i = 0; i < 8; i++) {
+      ASSIGN_OR_RETURN(Bit, bit, a->Get(i * spacing));
+      if (!bit) {
+        return false;
+      }
+    }
+    return true;
+  };
+}
+
+// A random decision tree of the given depth over 16 indices, always the same
+// one for a given depth.  Rarely true, so the search usually has to visit the
+// whole tree.
+RandomPredicate RandomTree(Natural depth) {
+  RandomPredicateOptions options;
+  options.max_depth = depth;
+  options.true_bias = 0.02;
+  return RandomPredicate::Generate(options, /*seed=*/depth);
+}
+
+std::string Name(const char *family, const char *variant, Natural param) {
+  return std::string(family) + "/" + variant + "/" + std::to_string(param);
+}
+
+// Registers `make_predicate(param)` under both search engines.  Enumeration is
+// exponential in the number of indices, so it gets its own parameter range.
+template <typename MakePredicateTy>
+void RunSearchFamily(BenchmarkRunner *runner, const char *family,
+                     MakePredicateTy make_predicate,
+                     std::initializer_list<Natural> enumeration_params,
+                     std::initializer_list<Natural> tree_search_params) {
+  for (Natural param : enumeration_params) {
+    auto predicate = make_predicate(param);
+    runner->Run(Name(family, "ForSome", param), [&](int64_t iterations) {
+      for (int64_t i = 0; i < iterations; i++) {
+        DoNotOptimize(ForSome(predicate));
+      }
+    });
+  }
+  for (Natural param : tree_search_params) {
+    auto predicate = make_predicate(param);
+    runner->Run(Name(family, "ForSomeTreeSearch", param),
+                [&](int64_t iterations) {
+                  for (int64_t i = 0; i < iterations; i++) {
+                    DoNotOptimize(ForSomeTreeSearch(predicate));
+                  }
+                });
+  }
+}
+
+template <typename PredicateTy>
+void RunEqual(BenchmarkRunner *runner, const std::string &name, PredicateTy a,
+              PredicateTy b) {
+  runner->Run(name, [&](int64_t iterations) {
+    for (int64_t i = 0; i < iterations; i++) {
+      DoNotOptimize(Equal<Bit>(a, b));
+    }
+  });
+}
+
+template <typename PredicateTy>
+void RunModulus(BenchmarkRunner *runner, const std::string &name,
+                PredicateTy predicate) {
+  runner->Run(name, [&](int64_t iterations) {
+    for (int64_t i = 0; i < iterations; i++) {
+      DoNotOptimize(Modulus<Bit>(predicate));
+    }
+  });
+}
+
+int main(int argc, char **argv) {
+  BenchmarkOptions options;
+  if (!ParseBenchmarkOptions(argc, argv, &options)) {
+    return 1;
+  }
+  Profiler::SetMode(ProfileMode::kOff);
+  BenchmarkRunner runner(options);
+
+  RunSearchFamily(&runner, "prefix", Prefix, {4, 8, 12, 16},
+                  {4, 8, 12, 16, 64, 256});
+  auto chain = [](Natural depth) { return AdaptiveChain(depth, true); };
+  RunSearchFamily(&runner, "chain", chain, {2, 3, 4}, {2, 3, 4, 8, 12, 16});
+  RunSearchFamily(&runner, "wide", Wide, {4, 8, 12, 16}, {4, 8, 12});
+  RunSearchFamily(&runner, "random", RandomTree, {4, 8, 12}, {4, 8, 12, 16});
+  RunSearchFamily(&runner, "far", FarIndices, {1, 64, 4096, 65536},
+                  {1, 64, 4096, 65536});
+
+  RunEqual(&runner, "equal/true/FuncF", FuncF, FuncF);
+  RunEqual(&runner, "equal/false/FuncF-FuncG", FuncF, FuncG);
+  for (Natural depth : {2, 3, 4}) {
+    RunEqual(&runner, Name("equal", "true/chain", depth),
+             AdaptiveChain(depth, true), AdaptiveChain(depth, true));
+    RunEqual(&runner, Name("equal", "false/chain", depth),
+             AdaptiveChain(depth, true), AdaptiveChain(depth, false));
+  }
+  for (Natural k : {4, 8}) {
+    RunEqual(&runner, Name("equal", "true/wide", k), Wide(k), Wide(k));
+    RunEqual(&runner, Name("equal", "false/wide", k), Wide(k), Wide(k + 1));
+  }
+
+  RunModulus(&runner, "modulus/FuncF", FuncF);
+  RunModulus(&runner, "modulus/FuncG", FuncG);
+  for (Natural k : {2, 4, 6}) {
+    RunModulus(&runner, Name("modulus", "prefix", k), Prefix(k));
+  }
+  for (Natural depth : {1, 2}) {
+    RunModulus(&runner, Name("modulus", "chain", depth),
+               AdaptiveChain(depth, true));
+  }
+  for (Natural k : {2, 4}) {
+    RunModulus(&runner, Name("modulus", "wide", k), Wide(k));
+  }
+
+  if (!runner.Finish()) {
+    return 1;
+  }
+}
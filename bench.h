@@ -0,0 +1,477 @@
+#ifndef IMPOSSIBLE_PROGRAMS_BENCH_H
+#define IMPOSSIBLE_PROGRAMS_BENCH_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "impossible.h"
+
+// The harness shared by the benchmark binaries.
+//
+// A benchmark is a function that performs `iterations` operations, where an
+// operation is whatever the benchmark measures: a whole search for bench, a
+// single call into a primitive for microbench.  Benchmarks whose natural unit
+// of work is a batch can say how many operations one iteration stands for.
+//
+// BenchmarkRunner first grows `iterations` until one call takes at least
+// --min_time_ms, then runs a few untimed warmup calls and finally
+// --repetitions timed ones.  Each benchmark prints a line of summary
+// statistics and, with --json, a line of JSON with the raw per-repetition
+// samples.
+//
+// Such a JSON file serves as a baseline for later runs: with --baseline the
+// runner compares every benchmark it ran against the baseline's and prints
+// the change in median ns/op, whether it is significant given the variance
+// of the repetitions (Welch's t-test) and a summary.
+
+struct BenchmarkOptions {
+  int warmup = 1;
+  int repetitions = 5;
+  int64_t min_time_ms = 10;
+
+  // Only benchmarks whose name contains this are run, if set.
+  const char *filter = nullptr;
+
+  // Where to write the JSON results, if set.
+  const char *json_path = nullptr;
+
+  // JSON results of an earlier run to compare against, if set.
+  const char *baseline_path = nullptr;
+
+  // Changes with a p-value below this are reported as significant.
+  double significance_level = 0.05;
+};
+
+// Parses `--name=value` flags into `options`.  Prints a usage message and
+// returns false on anything it does not recognize.
+inline bool ParseBenchmarkOptions(int argc, char **argv,
+                                  BenchmarkOptions *options) {
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *value = strchr(arg, '=');
+    if (strncmp(arg, "--", 2) != 0 || !value) {
+      fprintf(stderr, "Unexpected argument %s\n", arg);
+      return false;
+    }
+    std::string name(arg + 2, value - arg - 2);
+    value++;
+
+    if (name == "warmup") {
+      options->warmup = atoi(value);
+    } else if (name == "repetitions") {
+      options->repetitions = std::max(atoi(value), 1);
+    } else if (name == "min_time_ms") {
+      options->min_time_ms = atoll(value);
+    } else if (name == "filter") {
+      options->filter = value;
+    } else if (name == "json") {
+      options->json_path = value;
+    } else if (name == "baseline") {
+      options->baseline_path = value;
+    } else if (name == "significance_level") {
+      options->significance_level = atof(value);
+    } else {
+      fprintf(stderr,
+              "Unknown flag --%s\n"
+              "Usage: %s [--warmup=N] [--repetitions=N] [--min_time_ms=N] "
+              "[--filter=SUBSTRING] [--json=PATH] [--baseline=PATH] "
+              "[--significance_level=P]\n",
+              name.c_str(), argv[0]);
+      return false;
+    }
+  }
+  return true;
+}
+
+// Keeps the compiler from optimizing away the computation of `value`.
+template <typename T> inline void DoNotOptimize(const T &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Returns `pointer`, but the compiler can no longer tell what it points to.
+// Calls through it stay virtual, as they are for predicates reading a
+// BitSequence *.
+template <typename T> inline T *OpaquePointer(T *pointer) {
+  asm volatile("" : "+r"(pointer));
+  return pointer;
+}
+
+struct BenchmarkResult {
+  std::string name;
+
+  // Iterations performed by each timed repetition, and operations per
+  // iteration.
+  int64_t iterations = 0;
+  int64_t ops_per_iteration = 1;
+
+  // The duration of each timed repetition.
+  std::vector<int64_t> samples_ns;
+
+  // The searches made by the last timed repetition.
+  SearchStats stats;
+
+  int64_t ops() const { return iterations * ops_per_iteration; }
+
+  double MinNsPerOp() const {
+    return *std::min_element(samples_ns.begin(), samples_ns.end()) /
+           static_cast<double>(ops());
+  }
+
+  double MedianNsPerOp() const {
+    std::vector<int64_t> sorted = samples_ns;
+    std::sort(sorted.begin(), sorted.end());
+    size_t mid = sorted.size() / 2;
+    double median = sorted.size() % 2 ? sorted[mid]
+                                      : (sorted[mid - 1] + sorted[mid]) / 2.0;
+    return median / ops();
+  }
+
+  double MeanNsPerOp() const {
+    double sum = 0;
+    for (int64_t sample : samples_ns) {
+      sum += sample;
+    }
+    return sum / samples_ns.size() / ops();
+  }
+
+  // The sample standard deviation of the per-repetition ns/op.
+  double StddevNsPerOp() const {
+    if (samples_ns.size() < 2) {
+      return 0;
+    }
+    double mean = MeanNsPerOp(), sum_of_squares = 0;
+    for (int64_t sample : samples_ns) {
+      double delta = static_cast<double>(sample) / ops() - mean;
+      sum_of_squares += delta * delta;
+    }
+    return std::sqrt(sum_of_squares / (samples_ns.size() - 1));
+  }
+};
+
+inline void WriteBenchmarkResultJson(FILE *out, const BenchmarkResult &result) {
+  fprintf(out, "{\"name\": ");
+  WriteJsonString(out, result.name.c_str());
+  fprintf(out,
+          ", \"ops\": %lld, \"min_ns_per_op\": %.3lf, "
+          "\"median_ns_per_op\": %.3lf, \"mean_ns_per_op\": %.3lf, "
+          "\"stddev_ns_per_op\": %.3lf, \"ops_per_sec\": %.3lf, "
+          "\"searches\": %lld, \"predicate_invocations\": %lld, "
+          "\"get_calls\": %lld, \"samples_ns\": [",
+          static_cast<long long>(result.ops()),
+          result.MinNsPerOp(), result.MedianNsPerOp(), result.MeanNsPerOp(),
+          result.StddevNsPerOp(), 1e9 / result.MedianNsPerOp(),
+          static_cast<long long>(result.stats.searches),
+          static_cast<long long>(result.stats.predicate_invocations),
+          static_cast<long long>(result.stats.get_calls));
+  for (size_t i = 0; i < result.samples_ns.size(); i++) {
+    fprintf(out, "%s%lld", i ? ", " : "",
+            static_cast<long long>(result.samples_ns[i]));
+  }
+  fprintf(out, "]}\n");
+}
+
+// Reads the rest of a JSON string written by WriteJsonString, starting just
+// after its opening quote, into `text`.  Returns false if it is malformed.
+inline bool ReadJsonStringBody(const char *json, std::string *text) {
+  text->clear();
+  for (const char *c = json; *c; c++) {
+    if (*c == '"') {
+      return true;
+    }
+    if (*c != '\\') {
+      text->push_back(*c);
+    } else if (c[1] == '"' || c[1] == '\\') {
+      text->push_back(*++c);
+    } else if (c[1] == 'u' && strspn(c + 2, "0123456789abcdefABCDEF") >= 4) {
+      char hex[5] = {c[2], c[3], c[4], c[5], 0};
+      text->push_back(static_cast<char>(strtol(hex, nullptr, 16)));
+      c += 5;
+    } else {
+      return false;
+    }
+  }
+  return false;
+}
+
+// Reads results written by WriteBenchmarkResultJson.  Only the name, the
+// operation count and the samples are read back, which is all a comparison
+// needs.  Returns false if `in` holds anything else.
+inline bool ReadBenchmarkResultsJson(FILE *in,
+                                     std::vector<BenchmarkResult> *results) {
+  char line[1 << 16];
+  while (fgets(line, sizeof(line), in)) {
+    if (line[0] == '\n') {
+      continue;
+    }
+    const char *name = strstr(line, "\"name\": \"");
+    const char *ops = strstr(line, "\"ops\": ");
+    const char *samples = strstr(line, "\"samples_ns\": [");
+    if (!name || !ops || !samples) {
+      return false;
+    }
+
+    BenchmarkResult result;
+    name += strlen("\"name\": \"");
+    if (!ReadJsonStringBody(name, &result.name)) {
+      return false;
+    }
+    result.iterations = strtoll(ops + strlen("\"ops\": "), nullptr, 10);
+
+    char *cursor = const_cast<char *>(samples) + strlen("\"samples_ns\": [");
+    while (*cursor != ']') {
+      char *end;
+      result.samples_ns.push_back(strtoll(cursor, &end, 10));
+      if (end == cursor) {
+        return false;
+      }
+      cursor = end + strspn(end, ", ");
+    }
+    if (result.iterations <= 0 || result.samples_ns.empty()) {
+      return false;
+    }
+    results->push_back(std::move(result));
+  }
+  return !ferror(in);
+}
+
+// The regularized incomplete beta function I_x(a, b), by its continued
+// fraction (Numerical Recipes, 6.4).
+inline double RegularizedIncompleteBeta(double x, double a, double b) {
+  if (x <= 0 || x >= 1) {
+    return x <= 0 ? 0 : 1;
+  }
+  // The continued fraction converges quickly for x < (a + 1) / (a + b + 2);
+  // use the symmetry I_x(a, b) = 1 - I_(1-x)(b, a) otherwise.
+  if (x > (a + 1) / (a + b + 2)) {
+    return 1 - RegularizedIncompleteBeta(1 - x, b, a);
+  }
+
+  double log_front = std::lgamma(a + b) - std::lgamma(a) - std::lgamma(b) +
+                     a * std::log(x) + b * std::log(1 - x);
+  constexpr double kTiny = 1e-300;
+  double c = 1, d = 1 - (a + b) * x / (a + 1);
+  d = 1 / (std::fabs(d) < kTiny ? kTiny : d);
+  double fraction = d;
+  for (int m = 1; m <= 200; m++) {
+    for (int step = 0; step < 2; step++) {
+      double numerator =
+          step == 0
+              ? m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m))
+              : -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1));
+      d = 1 + numerator * d;
+      d = 1 / (std::fabs(d) < kTiny ? kTiny : d);
+      c = 1 + numerator / c;
+      c = std::fabs(c) < kTiny ? kTiny : c;
+      fraction *= c * d;
+    }
+    if (std::fabs(c * d - 1) < 1e-12) {
+      break;
+    }
+  }
+  return std::exp(log_front) * fraction / a;
+}
+
+// The two-sided p-value of Welch's t-test for the hypothesis that the
+// per-repetition ns/op of `a` and `b` have the same mean.  Returns 1 if either
+// has fewer than two repetitions.
+inline double WelchTTestPValue(const BenchmarkResult &a,
+                               const BenchmarkResult &b) {
+  if (a.samples_ns.size() < 2 || b.samples_ns.size() < 2) {
+    return 1;
+  }
+  double var_a = a.StddevNsPerOp() * a.StddevNsPerOp() / a.samples_ns.size();
+  double var_b = b.StddevNsPerOp() * b.StddevNsPerOp() / b.samples_ns.size();
+  double difference = a.MeanNsPerOp() - b.MeanNsPerOp();
+  if (var_a + var_b == 0) {
+    return difference == 0 ? 1 : 0;
+  }
+
+  double t = difference / std::sqrt(var_a + var_b);
+  double df = (var_a + var_b) * (var_a + var_b) /
+              (var_a * var_a / (a.samples_ns.size() - 1) +
+               var_b * var_b / (b.samples_ns.size() - 1));
+  return RegularizedIncompleteBeta(df / (df + t * t), df / 2, 0.5);
+}
+
+// Prints how each of `current` changed relative to the benchmark of the same
+// name in `baseline`, followed by the benchmarks only in `baseline` and a
+// summary.  Changes are in mean ns/op, the statistic the t-test compares, so
+// that a significant change is reported in the direction it was tested in.
+inline void
+CompareBenchmarkResults(FILE *out, const std::vector<BenchmarkResult> &baseline,
+                        const std::vector<BenchmarkResult> &current,
+                        double significance_level) {
+  fprintf(out, "\n%-40s %14s %14s %9s %9s  %s\n", "benchmark",
+          "baseline mean", "current mean", "change", "p-value", "verdict");
+  auto find = [](const std::vector<BenchmarkResult> &results,
+                 const std::string &name) {
+    return std::find_if(
+        results.begin(), results.end(),
+        [&](const BenchmarkResult &other) { return other.name == name; });
+  };
+  int faster = 0, slower = 0, unchanged = 0, added = 0, removed = 0;
+  double log_speedup_sum = 0;
+  for (const BenchmarkResult &result : current) {
+    auto old = find(baseline, result.name);
+    if (old == baseline.end()) {
+      fprintf(out, "%-40s %14s %14.1lf %9s %9s  %s\n", result.name.c_str(),
+              "-", result.MeanNsPerOp(), "-", "-", "new");
+      added++;
+      continue;
+    }
+
+    double change = result.MeanNsPerOp() / old->MeanNsPerOp() - 1;
+    double p_value = WelchTTestPValue(*old, result);
+    const char *verdict = "unchanged";
+    if (p_value < significance_level) {
+      verdict = change < 0 ? "faster" : "SLOWER";
+      (change < 0 ? faster : slower)++;
+    } else {
+      unchanged++;
+    }
+    log_speedup_sum += std::log(old->MeanNsPerOp() / result.MeanNsPerOp());
+    fprintf(out, "%-40s %14.1lf %14.1lf %+8.1lf%% %9.4lf  %s\n",
+            result.name.c_str(), old->MeanNsPerOp(), result.MeanNsPerOp(),
+            100 * change, p_value, verdict);
+  }
+  for (const BenchmarkResult &result : baseline) {
+    if (find(current, result.name) == current.end()) {
+      fprintf(out, "%-40s %14.1lf %14s %9s %9s  %s\n", result.name.c_str(),
+              result.MeanNsPerOp(), "-", "-", "-", "not run");
+      removed++;
+    }
+  }
+
+  int compared = faster + slower + unchanged;
+  fprintf(out,
+          "\n%d compared: %d faster, %d slower, %d unchanged at p < %.3lf; "
+          "%d not in the baseline, %d not run\n",
+          compared, faster, slower, unchanged, significance_level, added,
+          removed);
+  if (compared > 0) {
+    fprintf(out, "Geometric mean speedup: %.3lfx\n",
+            std::exp(log_speedup_sum / compared));
+  }
+}
+
+class BenchmarkRunner {
+public:
+  explicit BenchmarkRunner(BenchmarkOptions options) : options_(options) {
+    printf("%-40s %12s %14s %14s %9s %14s\n", "benchmark", "ops",
+           "median ns/op", "min ns/op", "stddev", "ops/sec");
+  }
+
+  // Benchmarks `fn`, which must perform `ops_per_iteration` of the operations
+  // it measures as many times as its int64_t argument says.
+  template <typename FnTy>
+  void Run(const std::string &name, FnTy fn, int64_t ops_per_iteration = 1) {
+    if (!Selected(name)) {
+      return;
+    }
+
+    BenchmarkResult result;
+    result.name = name;
+    result.ops_per_iteration = ops_per_iteration;
+    result.iterations = Calibrate(fn);
+    for (int i = 0; i < options_.warmup; i++) {
+      fn(result.iterations);
+    }
+    for (int i = 0; i < options_.repetitions; i++) {
+      result.stats = SearchStats();
+      CollectSearchStats collect(&result.stats);
+      result.samples_ns.push_back(Time(fn, result.iterations));
+    }
+
+    printf("%-40s %12lld %14.1lf %14.1lf %8.1lf%% %14.1lf\n", name.c_str(),
+           static_cast<long long>(result.ops()), result.MedianNsPerOp(),
+           result.MinNsPerOp(),
+           100 * result.StddevNsPerOp() / result.MeanNsPerOp(),
+           1e9 / result.MedianNsPerOp());
+    fflush(stdout);
+    results_.push_back(std::move(result));
+  }
+
+  // Writes the JSON results and compares against the baseline, if either was
+  // asked for.  Returns false, after printing why, if a file could not be
+  // read or written.
+  bool Finish() {
+    if (options_.json_path) {
+      FILE *out = fopen(options_.json_path, "w");
+      bool written = out != nullptr;
+      if (out) {
+        for (const BenchmarkResult &result : results_) {
+          WriteBenchmarkResultJson(out, result);
+        }
+        written = fclose(out) == 0;
+      }
+      if (!written) {
+        fprintf(stderr, "Could not write %s\n", options_.json_path);
+        return false;
+      }
+    }
+
+    if (options_.baseline_path) {
+      std::vector<BenchmarkResult> baseline;
+      FILE *in = fopen(options_.baseline_path, "r");
+      bool read = in && ReadBenchmarkResultsJson(in, &baseline);
+      if (in) {
+        fclose(in);
+      }
+      if (!read) {
+        fprintf(stderr, "Could not read a baseline from %s\n",
+                options_.baseline_path);
+        return false;
+      }
+      // Benchmarks the filter left out were not meant to run.
+      baseline.erase(std::remove_if(baseline.begin(), baseline.end(),
+                                    [&](const BenchmarkResult &result) {
+                                      return !Selected(result.name);
+                                    }),
+                     baseline.end());
+      CompareBenchmarkResults(stdout, baseline, results_,
+                              options_.significance_level);
+    }
+    return true;
+  }
+
+private:
+  bool Selected(const std::string &name) const {
+    return !options_.filter || strstr(name.c_str(), options_.filter);
+  }
+
+  template <typename FnTy> static int64_t Time(FnTy &fn, int64_t iterations) {
+    auto start = std::chrono::steady_clock::now();
+    fn(iterations);
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+  }
+
+  // Returns the number of iterations that takes at least min_time_ms.
+  template <typename FnTy> int64_t Calibrate(FnTy &fn) {
+    int64_t min_time_ns = options_.min_time_ms * 1000000;
+    int64_t iterations = 1;
+    while (true) {
+      int64_t ns = std::max<int64_t>(Time(fn, iterations), 1);
+      if (ns >= min_time_ns) {
+        return iterations;
+      }
+      // Aim a little past the target, but grow by at most 10x at a time in
+      // case the first iterations were unusually fast.
+      double scale = std::min(1.2 * min_time_ns / ns, 10.0);
+      iterations = std::max<int64_t>(iterations * scale, iterations + 1);
+    }
+  }
+
+  BenchmarkOptions options_;
+  std::vector<BenchmarkResult> results_;
+};
+
+#endif
@@ -1,3 +1,6 @@
 #!/bin/bash
 
-clang++ -DNDEBUG -Wall -Werror -O3 main.cc -o main -std=c++17 -march=native
+clang++ -DNDEBUG -Wall -Werror -O3 main.cc -o main -std=c++17 -pthread -march=native
+clang++ -DNDEBUG -Wall -Werror -O3 trace_decode.cc -o trace_decode -std=c++17
+clang++ -DNDEBUG -Wall -Werror -O3 bench.cc -o bench -std=c++17 -march=native
+clang++ -DNDEBUG -Wall -Werror -O3 microbench.cc -o microbench -std=c++17 -march=native
@@ -1,3 +1,6 @@
 #!/bin/bash
 
-clang++ -fsanitize=undefined -fsanitize=address -g3 -O1 -Wall -Werror main.cc -o main -std=c++17 -DENABLE_LOG
+clang++ -fsanitize=undefined -fsanitize=address -g3 -O1 -Wall -Werror main.cc -o main -std=c++17 -pthread
+clang++ -fsanitize=undefined -fsanitize=address -g3 -O1 -Wall -Werror trace_decode.cc -o trace_decode -std=c++17
+clang++ -fsanitize=undefined -fsanitize=address -g3 -O1 -Wall -Werror bench.cc -o bench -std=c++17
+clang++ -fsanitize=undefined -fsanitize=address -g3 -O1 -Wall -Werror microbench.cc -o microbench -std=c++17
@@ -0,0 +1,2379 @@
+#ifndef IMPOSSIBLE_PROGRAMS_IMPOSSIBLE_H
+#define IMPOSSIBLE_PROGRAMS_IMPOSSIBLE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <limits>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <type_traits>
+#include <typeindex>
+#include <utility>
+#include <vector>
+
+#include "profiler.h"
+#include "trace.h"
+#include "utils.h"
+
+// Exhaustive search over Cantor space: the bit sequences, the search engines
+// (ForSome, ForSomeTreeSearch and DecisionTreeWalker), the views that map one
+// sequence onto another and the quantifiers built on top of them.  Included by
+// main.cc, which holds the tests, and by the benchmarks.
+
+using Bit = bool;
+using Natural = uint64_t;
+
+// Set of natural numbers, implemented as a bitset.
+class SetOfNaturals {
+public:
+  void Clear() {
+    rep_.clear();
+    size_ = 0;
+  }
+
+  void Insert(Natural idx) {
+    if (idx >= rep_.size()) {
+      rep_.resize(idx + 1, false);
+    }
+    size_ += !rep_[idx];
+    rep_[idx] = true;
+  }
+
+  bool Contains(Natural idx) const { return idx < rep_.size() && rep_[idx]; }
+
+  template <typename FnTy> void ForEach(FnTy func) const {
+    for (Natural i = 0, e = rep_.size(); i < e; i++) {
+      if (rep_[i]) {
+        func(i);
+      }
+    }
+  }
+
+  int64_t size() const { return size_; }
+
+private:
+  int64_t size_ = 0;
+  std::vector<bool> rep_;
+};
+
+class MappedBitSequence;
+
+// Counters describing the work done by searches, see CollectSearchStats.
+struct SearchStats {
+  // Calls to ForSome or ForSomeTreeSearch, including the ones made by
+  // ForEvery, Equal and Modulus.
+  int64_t searches = 0;
+  int64_t predicate_invocations = 0;
+  int64_t get_calls = 0;
+
+  // Times a predicate returned the sentinel: restarts with a bigger index set
+  // for ForSome's enumeration and new internal nodes for tree search.
+  int64_t sentinel_restarts = 0;
+
+  // Indices branched on: the final index set for enumeration and the number
+  // of internal nodes visited for tree search.
+  //
+  // A ForSome whose enumeration hands over to tree search at
+  // kMaxEnumeratedIndices counts both phases, in this field and in
+  // sentinel_restarts: the 64 indices enumerated plus the tree's internal
+  // nodes, which include those 64 again.  ForSome(FirstOneIsBit(128)) in
+  // main.cc reports 64 + 128 = 192.
+  int64_t indices_discovered = 0;
+
+  // Largest index branched on, or -1 if there was none.
+  int64_t max_index = -1;
+
+  // Assignments (or tree leaves) visited, including the ones whose
+  // evaluation was skipped because the predicate's footprint did not change.
+  int64_t assignments_enumerated = 0;
+
+  // Only filled in by CollectSearchStats.
+  int64_t wall_time_ns = 0;
+  int64_t cpu_time_ns = 0;
+
+  void Add(const SearchStats &other) {
+    searches += other.searches;
+    predicate_invocations += other.predicate_invocations;
+    get_calls += other.get_calls;
+    sentinel_restarts += other.sentinel_restarts;
+    indices_discovered += other.indices_discovered;
+    max_index = std::max(max_index, other.max_index);
+    assignments_enumerated += other.assignments_enumerated;
+    wall_time_ns += other.wall_time_ns;
+    cpu_time_ns += other.cpu_time_ns;
+  }
+
+  void NoteIndex(Natural idx) {
+    max_index = std::max(max_index, static_cast<int64_t>(idx));
+  }
+};
+
+// Writes `text` to `out` as a JSON string, quoted and escaped.
+inline void WriteJsonString(FILE *out, const char *text) {
+  fputc('"', out);
+  for (const char *c = text; *c; c++) {
+    unsigned char ch = *c;
+    if (ch == '"' || ch == '\\') {
+      fprintf(out, "\\%c", ch);
+    } else if (ch < 0x20) {
+      fprintf(out, "\\u%04x", ch);
+    } else {
+      fputc(ch, out);
+    }
+  }
+  fputc('"', out);
+}
+
+// Writes `stats` to `out` as a single line of JSON, labelled with `label`.
+inline void WriteSearchStatsJson(FILE *out, const char *label,
+                                 const SearchStats &stats) {
+  fprintf(out, "{\"label\": ");
+  WriteJsonString(out, label);
+  fprintf(out,
+          ", \"searches\": %lld, "
+          "\"predicate_invocations\": %lld, \"get_calls\": %lld, "
+          "\"sentinel_restarts\": %lld, \"indices_discovered\": %lld, "
+          "\"max_index\": %lld, \"assignments_enumerated\": %lld, "
+          "\"wall_time_ns\": %lld, \"cpu_time_ns\": %lld}\n",
+          static_cast<long long>(stats.searches),
+          static_cast<long long>(stats.predicate_invocations),
+          static_cast<long long>(stats.get_calls),
+          static_cast<long long>(stats.sentinel_restarts),
+          static_cast<long long>(stats.indices_discovered),
+          static_cast<long long>(stats.max_index),
+          static_cast<long long>(stats.assignments_enumerated),
+          static_cast<long long>(stats.wall_time_ns),
+          static_cast<long long>(stats.cpu_time_ns));
+}
+
+// While alive, adds the counters of every search started on this thread to
+// `stats`, together with the wall and CPU time the scope was alive for.
+// Scopes nest, and what an inner scope collects is also added to the enclosing
+// scope when the inner scope ends.
+//
+//   SearchStats stats;
+//   {
+//     CollectSearchStats collect(&stats);
+//     Modulus<Bit>(FuncF);
+//   }
+//   WriteSearchStatsJson(stdout, "Modulus<Bit>(FuncF)", stats);
+class CollectSearchStats {
+public:
+  explicit CollectSearchStats(SearchStats *stats)
+      : stats_(stats), parent_(active_),
+        wall_start_(std::chrono::steady_clock::now()),
+        cpu_start_ns_(ThreadCpuTimeNs()) {
+    active_ = this;
+  }
+
+  CollectSearchStats(const CollectSearchStats &) = delete;
+  CollectSearchStats &operator=(const CollectSearchStats &) = delete;
+
+  ~CollectSearchStats() {
+    collected_.wall_time_ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - wall_start_)
+            .count();
+    collected_.cpu_time_ns = ThreadCpuTimeNs() - cpu_start_ns_;
+    stats_->Add(collected_);
+
+    active_ = parent_;
+    if (parent_) {
+      // The parent measures its own time.
+      collected_.wall_time_ns = collected_.cpu_time_ns = 0;
+      parent_->collected_.Add(collected_);
+    }
+  }
+
+  // While alive, searches on this thread are not collected by the live
+  // scopes, as if it had none.
+  class Detached {
+  public:
+    Detached() : saved_(active_) { active_ = nullptr; }
+    ~Detached() { active_ = saved_; }
+
+    Detached(const Detached &) = delete;
+    Detached &operator=(const Detached &) = delete;
+
+  private:
+    CollectSearchStats *saved_;
+  };
+
+  // Hands the counters of a finished search to the innermost live scope.
+  static void Record(const SearchStats &search_stats) {
+    if (active_) {
+      active_->collected_.Add(search_stats);
+    }
+  }
+
+private:
+  static int64_t ThreadCpuTimeNs() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+  }
+
+  static inline thread_local CollectSearchStats *active_ = nullptr;
+
+  SearchStats *stats_;
+  CollectSearchStats *parent_;
+  SearchStats collected_;
+  std::chrono::steady_clock::time_point wall_start_;
+  int64_t cpu_start_ns_;
+};
+
+// Counters for a single search, handed to CollectSearchStats when the search
+// ends.
+class SearchStatsRecorder {
+public:
+  SearchStatsRecorder() { stats_.searches = 1; }
+  ~SearchStatsRecorder() { CollectSearchStats::Record(stats_); }
+
+  SearchStats *operator->() { return &stats_; }
+  SearchStats *get() { return &stats_; }
+
+private:
+  SearchStats stats_;
+};
+
+// Lets one thread ask searches running on another to stop.  A token with a
+// parent is also cancelled when its parent is.
+class CancellationToken {
+public:
+  explicit CancellationToken(const CancellationToken *parent = nullptr)
+      : parent_(parent) {}
+
+  void Cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+  bool IsCancelled() const {
+    return cancelled_.load(std::memory_order_relaxed) ||
+           (parent_ && parent_->IsCancelled());
+  }
+
+private:
+  std::atomic<bool> cancelled_{false};
+  const CancellationToken *parent_;
+};
+
+// Limits on the work a bounded quantifier may do before giving up with
+// Truth::kUnknown.  The limits cover the whole call, so a bounded Modulus
+// shares them between all the searches it makes.
+struct SearchBudget {
+  // Predicate evaluations, or no limit if negative.
+  int64_t max_evaluations = -1;
+
+  std::chrono::nanoseconds max_wall_time = std::chrono::nanoseconds::max();
+
+  // Not owned, and must outlive the call, if set.
+  const CancellationToken *cancellation = nullptr;
+};
+
+// Tracks what a bounded call has used of its SearchBudget.  The engines
+// charge it once per evaluation and stop as soon as it is exhausted.
+class BudgetMeter {
+public:
+  explicit BudgetMeter(const SearchBudget &budget)
+      : budget_(budget), start_(std::chrono::steady_clock::now()) {}
+
+  // Accounts for one more evaluation.  Returns false, and keeps returning
+  // false, once the budget is exhausted.  The clock and the cancellation
+  // token are only looked at every kCheckInterval evaluations, which bounds
+  // the overshoot to that many evaluations.
+  bool Charge() {
+    if (exhausted_) {
+      return false;
+    }
+    if (budget_.max_evaluations >= 0 &&
+        evaluations_ >= budget_.max_evaluations) {
+      exhausted_ = true;
+    } else if (evaluations_ % kCheckInterval == 0) {
+      exhausted_ = (budget_.cancellation &&
+                    budget_.cancellation->IsCancelled()) ||
+                   std::chrono::steady_clock::now() - start_ >
+                       budget_.max_wall_time;
+    }
+    evaluations_ += !exhausted_;
+    return !exhausted_;
+  }
+
+  bool exhausted() const { return exhausted_; }
+
+private:
+  static constexpr int64_t kCheckInterval = 64;
+
+  SearchBudget budget_;
+  std::chrono::steady_clock::time_point start_;
+  int64_t evaluations_ = 0;
+  bool exhausted_ = false;
+};
+
+enum class Truth { kFalse, kTrue, kUnknown };
+
+inline Truth ToTruth(Bit bit) { return bit ? Truth::kTrue : Truth::kFalse; }
+
+inline Truth Not(Truth truth) {
+  return truth == Truth::kUnknown ? truth
+         : truth == Truth::kTrue  ? Truth::kFalse
+                                  : Truth::kTrue;
+}
+
+inline const char *TruthName(Truth truth) {
+  return truth == Truth::kUnknown ? "unknown"
+         : truth == Truth::kTrue  ? "true"
+                                  : "false";
+}
+
+#define PRINT_TRUTH_EXPR(expr) PRINT_EXPR_IMPL(expr, "%s", TruthName(__val))
+
+// The result of a bounded quantifier, with the stats of the searches it made
+// whether or not it finished.
+struct BoundedTruth {
+  Truth truth = Truth::kUnknown;
+  SearchStats stats;
+};
+
+// The result of a bounded Modulus: empty if the budget ran out first.
+struct BoundedNatural {
+  std::optional<Natural> value;
+  SearchStats stats;
+};
+
+// The results of Memoized calls made by one search's predicate, one table per
+// memoized function, created on first use.
+class SearchMemo {
+public:
+  template <typename TableTy> TableTy *Table(std::type_index fn_type) {
+    std::shared_ptr<void> &table = tables_[fn_type];
+    if (!table) {
+      table = std::make_shared<TableTy>();
+    }
+    return static_cast<TableTy *>(table.get());
+  }
+
+private:
+  std::map<std::type_index, std::shared_ptr<void>> tables_;
+};
+
+// A search in progress on this thread.  Searches nest when a predicate runs a
+// quantifier of its own, e.g. ForEvery over `x` of ForSome over `y` of a
+// predicate on both, and then a sentinel the inner predicate gets may come
+// from either search's sequence.  Each sequence that returns the sentinel
+// tags it with the frame of the search that owns it, so that:
+//
+//  - a search whose own sequences returned no sentinel, but whose enclosing
+//    search's did, gives up: its answer depends on a bit the enclosing search
+//    has not assigned yet, and
+//  - the enclosing search, whose predicate may return a value computed from
+//    that abandoned answer, treats the evaluation as having returned the
+//    sentinel, and restarts with the bit included.
+//
+// Frames are created by the engines, and must be destroyed in reverse order.
+class SearchFrame {
+public:
+  // Memoized calls share `memo`, if set, with other frames of the same
+  // search, and otherwise get a memo of their own.
+  explicit SearchFrame(SearchMemo *memo = nullptr)
+      : parent_(active_), memo_(memo) {
+    active_ = this;
+  }
+  ~SearchFrame() { active_ = parent_; }
+
+  SearchFrame(const SearchFrame &) = delete;
+  SearchFrame &operator=(const SearchFrame &) = delete;
+
+  // While alive, searches on this thread do not nest in the live frames, as
+  // if it had none.
+  class Detached {
+  public:
+    Detached() : saved_(active_) { active_ = nullptr; }
+    ~Detached() { active_ = saved_; }
+
+    Detached(const Detached &) = delete;
+    Detached &operator=(const Detached &) = delete;
+
+  private:
+    SearchFrame *saved_;
+  };
+
+  // The innermost frame on this thread, or null outside any search.
+  static SearchFrame *active() { return active_; }
+
+  SearchMemo *memo() {
+    if (!memo_) {
+      own_memo_ = std::make_unique<SearchMemo>();
+      memo_ = own_memo_.get();
+    }
+    return memo_;
+  }
+
+  // Called by the frame's sequences when they return the sentinel.
+  void NoteSentinel() { sentinel_ = true; }
+
+  // Starts an evaluation of the frame's predicate.
+  void BeginEvaluation() { sentinel_ = tainted_ = false; }
+
+  // Whether one of the frame's sequences returned the sentinel during the
+  // current evaluation.
+  bool sentinel() const { return sentinel_; }
+
+  // Whether the current evaluation made a nested search give up, so that the
+  // value it returned cannot be trusted.
+  bool tainted() const { return tainted_; }
+
+  // Returns true, and remembers that the search gave up, if an enclosing
+  // frame's sequence has returned the sentinel during that frame's current
+  // evaluation.  Called by the search after each evaluation of its own.
+  bool ShouldAbandon() {
+    for (SearchFrame *frame = parent_; frame; frame = frame->parent_) {
+      if (frame->sentinel_) {
+        frame->tainted_ = true;
+        abandoned_ = true;
+      }
+    }
+    return abandoned_;
+  }
+
+  bool abandoned() const { return abandoned_; }
+
+private:
+  static inline thread_local SearchFrame *active_ = nullptr;
+
+  SearchFrame *parent_;
+  SearchMemo *memo_;
+  std::unique_ptr<SearchMemo> own_memo_;
+  bool sentinel_ = false;
+  bool tainted_ = false;
+  bool abandoned_ = false;
+};
+
+// A possibly infinite sequence of bits.
+class BitSequence {
+public:
+  // Subclasses override this method to provide class specific functionality.
+  //
+  // Either returns a bit or a sentinel value (std::optional).
+  virtual std::optional<Bit> Get(Natural) = 0;
+  virtual ~BitSequence() {}
+
+  // Returns this sequence as a foldable view, or null if it is not one.
+  virtual MappedBitSequence *AsMappedView() { return nullptr; }
+};
+
+// The set of sequences that agree with `bits`, a cylinder of Cantor space.
+// `bits` holds (index, value) pairs sorted by index.
+struct Cylinder {
+  std::vector<std::pair<Natural, Bit>> bits;
+
+  // Prints the assignment as e.g. `b4=1 b7=0`, or `*` for all of Cantor
+  // space.
+  void Print(FILE *out) const {
+    if (bits.empty()) {
+      fprintf(out, "*");
+    }
+    for (size_t i = 0; i < bits.size(); i++) {
+      fprintf(out, "%sb%llu=%d", i ? " " : "",
+              static_cast<unsigned long long>(bits[i].first), bits[i].second);
+    }
+    fprintf(out, "\n");
+  }
+};
+
+// One sequence of `cylinder`: the one whose bits outside the cylinder's
+// assignment are all zero.
+class CylinderBitSequence : public BitSequence {
+public:
+  explicit CylinderBitSequence(const Cylinder *cylinder)
+      : cylinder_(*cylinder) {}
+  virtual ~CylinderBitSequence() override {}
+
+  std::optional<Bit> Get(Natural idx) override {
+    auto it = std::lower_bound(
+        cylinder_.bits.begin(), cylinder_.bits.end(), idx,
+        [](const std::pair<Natural, Bit> &bit, Natural idx) {
+          return bit.first < idx;
+        });
+    return it != cylinder_.bits.end() && it->first == idx && it->second;
+  }
+
+private:
+  const Cylinder &cylinder_;
+};
+
+// This bit sequence contains a finite prefix of an infinite bit sequence.
+//
+// If the caller asks for bits beyond the prefix it was told about, it returns
+// the sentinel.  It also keeps track of the indices that it returned sentinel
+// for.
+//
+// The values of the present bits are changed one at a time through FlipBit,
+// which lets the sequence tell whether anything read by the last evaluation
+// has changed since.
+class LazyBitSequence : public BitSequence {
+public:
+  // Sentinels are tagged with `frame`, if set.
+  explicit LazyBitSequence(std::vector<Bit> *values,
+                           const SetOfNaturals *indices_present,
+                           SetOfNaturals *unfulfilled_indices,
+                           std::vector<uint64_t> *last_read_in_evaluation,
+                           SearchFrame *frame = nullptr)
+      : values_(*values), indices_present_(*indices_present),
+        unfulfilled_indices_(unfulfilled_indices),
+        last_read_in_evaluation_(*last_read_in_evaluation), frame_(frame) {
+    last_read_in_evaluation_.assign(values_.size(), 0);
+  }
+  virtual ~LazyBitSequence() override {}
+
+  std::optional<Bit> Get(Natural idx) override {
+    get_calls_++;
+    if (indices_present_.Contains(idx)) {
+      last_read_in_evaluation_[idx] = evaluation_;
+      return values_[idx];
+    }
+
+    unfulfilled_indices_->Insert(idx);
+    if (frame_) {
+      frame_->NoteSentinel();
+    }
+    return std::nullopt;
+  }
+
+  // Marks the start of a new evaluation of the predicate over this sequence.
+  void BeginEvaluation() {
+    evaluation_++;
+    footprint_changed_ = false;
+  }
+
+  // Flips the present bit `idx`.
+  void FlipBit(Natural idx) {
+    values_[idx] = !values_[idx];
+    footprint_changed_ |= last_read_in_evaluation_[idx] == evaluation_;
+  }
+
+  // Returns true if a bit read during the last evaluation has been flipped
+  // since that evaluation.  If this returns false, the predicate is guaranteed
+  // to return the same value it returned last time.
+  bool FootprintChanged() const { return footprint_changed_; }
+
+  // Sets `cylinder` to the bits read during the last evaluation.
+  void GetFootprint(Cylinder *cylinder) const {
+    cylinder->bits.clear();
+    indices_present_.ForEach([&](Natural idx) {
+      if (last_read_in_evaluation_[idx] == evaluation_) {
+        cylinder->bits.emplace_back(idx, values_[idx]);
+      }
+    });
+  }
+
+  int64_t get_calls() const { return get_calls_; }
+
+  SearchFrame *frame() const { return frame_; }
+
+private:
+  std::vector<bool> &values_;
+  const SetOfNaturals &indices_present_;
+  SetOfNaturals *unfulfilled_indices_;
+
+  // Evaluations are numbered starting from 1, and
+  // `last_read_in_evaluation_[idx]` is the last evaluation that read `idx`.
+  uint64_t evaluation_ = 0;
+  std::vector<uint64_t> &last_read_in_evaluation_;
+  bool footprint_changed_ = false;
+  int64_t get_calls_ = 0;
+  SearchFrame *frame_;
+};
+
+// Enumerates all assignments to `slot_count` < 64 slots in Gray code order,
+// starting from the all zero assignment.  Consecutive assignments differ in
+// exactly one slot, which is the number of trailing zeros in the step counter.
+class GrayCodeEnumerator {
+public:
+  explicit GrayCodeEnumerator(int slot_count) : slot_count_(slot_count) {}
+
+  // Moves to the next assignment.  Returns false if all 2^`slot_count`
+  // assignments have been visited.
+  bool Next() {
+    counter_++;
+    if (counter_ >> slot_count_) {
+      return false;
+    }
+    flipped_slot_ = __builtin_ctzll(counter_);
+    return true;
+  }
+
+  // The slot that the last call to Next flipped, or -1 before the first call.
+  int flipped_slot() const { return flipped_slot_; }
+
+private:
+  int slot_count_;
+  uint64_t counter_ = 0;
+  int flipped_slot_ = -1;
+};
+
+// Specialized LazyBitSequence for the common case where the bits present are
+// exactly the bits [0, `size`), with `size` < 64.  The values are packed into a
+// single word, so Get is a shift and a mask.
+class PrefixBitSequence : public BitSequence {
+public:
+  explicit PrefixBitSequence(int size, SetOfNaturals *unfulfilled_indices,
+                             SearchFrame *frame = nullptr)
+      : size_(size), unfulfilled_indices_(unfulfilled_indices), frame_(frame) {
+  }
+  virtual ~PrefixBitSequence() override {}
+
+  std::optional<Bit> Get(Natural idx) override {
+    get_calls_++;
+    if (idx < static_cast<Natural>(size_)) {
+      read_mask_ |= 1ull << idx;
+      return (values_ >> idx) & 1;
+    }
+
+    unfulfilled_indices_->Insert(idx);
+    if (frame_) {
+      frame_->NoteSentinel();
+    }
+    return std::nullopt;
+  }
+
+  void BeginEvaluation() {
+    read_mask_ = 0;
+    footprint_changed_ = false;
+  }
+
+  void FlipBit(Natural idx) {
+    values_ ^= 1ull << idx;
+    footprint_changed_ |= (read_mask_ >> idx) & 1;
+  }
+
+  bool FootprintChanged() const { return footprint_changed_; }
+
+  void GetFootprint(Cylinder *cylinder) const {
+    cylinder->bits.clear();
+    for (uint64_t read = read_mask_; read; read &= read - 1) {
+      Natural idx = __builtin_ctzll(read);
+      cylinder->bits.emplace_back(idx, (values_ >> idx) & 1);
+    }
+  }
+
+  int64_t get_calls() const { return get_calls_; }
+
+  SearchFrame *frame() const { return frame_; }
+
+private:
+  int size_;
+  SetOfNaturals *unfulfilled_indices_;
+  uint64_t values_ = 0;
+  uint64_t read_mask_ = 0;
+  bool footprint_changed_ = false;
+  int64_t get_calls_ = 0;
+  SearchFrame *frame_;
+};
+
+// Evaluates `predicate` on every assignment to the present bits of `sequence`,
+// `slot_count` of them, where slot `I` is the bit at index `slot_index(I)`.
+//
+// Returns true if the predicate returned true on some assignment, false if it
+// returned false on all of them and the sentinel if it asked for a bit that is
+// not present.  If `meter` is set and runs out, or the search has to give up
+// for an enclosing one (see SearchFrame), the result is meaningless.
+template <typename SequenceTy, typename SlotIndexFnTy, typename PredicateTy>
+std::optional<Bit> EnumerateAssignments(SequenceTy *sequence, int slot_count,
+                                        SlotIndexFnTy slot_index,
+                                        PredicateTy &predicate,
+                                        SearchStats *stats,
+                                        BudgetMeter *meter) {
+  GrayCodeEnumerator enumerator(slot_count);
+  for (bool more = true; more; more = enumerator.Next()) {
+    stats->assignments_enumerated++;
+    if (enumerator.flipped_slot() >= 0) {
+      sequence->FlipBit(slot_index(enumerator.flipped_slot()));
+
+      // The predicate can only depend on the bits it reads, so it would
+      // return false again.
+      if (!sequence->FootprintChanged()) {
+        continue;
+      }
+    }
+
+    if (meter && !meter->Charge()) {
+      return false;
+    }
+    sequence->BeginEvaluation();
+    if (SearchFrame *frame = sequence->frame()) {
+      frame->BeginEvaluation();
+    }
+    stats->predicate_invocations++;
+    TRACE_EVENT(kEvaluationBegin, 0);
+    std::optional<Bit> result;
+    {
+      PROFILE_DETAILED_SCOPE("predicate");
+      result = predicate(sequence);
+    }
+    if (SearchFrame *frame = sequence->frame()) {
+      if (frame->ShouldAbandon()) {
+        return false;
+      }
+      if (frame->tainted()) {
+        result = std::nullopt;
+      }
+    }
+    TRACE_EVENT(kEvaluationEnd, result.has_value() ? *result : 2);
+    if (!result.has_value() || *result) {
+      if (result.has_value()) {
+        TRACE_EVENT(kWitnessFound, 0);
+      }
+      return result;
+    }
+  }
+
+  return false;
+}
+
+// A bit sequence backed by a partial assignment that is built up one index at
+// a time.  Get on an unassigned index returns the sentinel and remembers the
+// index, so the caller can branch on it.
+class PartialAssignmentSequence : public BitSequence {
+public:
+  virtual ~PartialAssignmentSequence() override {}
+
+  std::optional<Bit> Get(Natural idx) override {
+    get_calls_++;
+    if (idx < assigned_.size() && assigned_[idx]) {
+      return values_[idx];
+    }
+
+    if (!requested_index_.has_value()) {
+      requested_index_ = idx;
+    }
+    if (frame_) {
+      frame_->NoteSentinel();
+    }
+    return std::nullopt;
+  }
+
+  void Assign(Natural idx, Bit value) {
+    if (idx >= assigned_.size()) {
+      assigned_.resize(idx + 1, false);
+      values_.resize(idx + 1, false);
+    }
+    assigned_[idx] = true;
+    values_[idx] = value;
+  }
+
+  void Unassign(Natural idx) { assigned_[idx] = false; }
+
+  void BeginEvaluation() { requested_index_ = std::nullopt; }
+
+  // Unassigns every index.
+  void Clear() {
+    assigned_.assign(assigned_.size(), false);
+    get_calls_ = 0;
+  }
+
+  int64_t get_calls() const { return get_calls_; }
+
+  // The first unassigned index asked for since the last BeginEvaluation.
+  std::optional<Natural> requested_index() const { return requested_index_; }
+
+  // Tags sentinels with `frame` from now on, or with nothing if it is null.
+  void set_frame(SearchFrame *frame) { frame_ = frame; }
+
+private:
+  std::vector<bool> assigned_;
+  std::vector<bool> values_;
+  std::optional<Natural> requested_index_;
+  int64_t get_calls_ = 0;
+  SearchFrame *frame_ = nullptr;
+};
+
+// Walks the decision tree that `predicate` induces on Cantor space, depth
+// first, visiting the 0 branch before the 1 branch.  The internal nodes of the
+// tree are the indices the predicate asks for and the leaves are the partial
+// assignments on which it returns a value of type T.
+//
+// Each step re-runs the predicate on the current path, so visiting every leaf
+// costs O(tree size * depth) Gets.  That depends only on how adaptive the
+// predicate is, not on how many distinct indices it reads overall, so unlike
+// ForSome's enumeration there is no limit on the number of indices.
+template <typename T, typename PredicateTy> class DecisionTreeWalker {
+public:
+  struct Decision {
+    Natural index;
+    Bit value;
+  };
+
+  // The walk charges every evaluation to `meter`, if set, and stops when it
+  // runs out.  Memoized calls made by the predicate share `memo`, if set,
+  // and otherwise a memo that lives as long as the walker.
+  explicit DecisionTreeWalker(PredicateTy predicate,
+                              BudgetMeter *meter = nullptr,
+                              SearchMemo *memo = nullptr)
+      : predicate_(std::move(predicate)), meter_(meter),
+        memo_(memo ? memo : &own_memo_) {
+    state_->sequence.Clear();
+    state_->path.clear();
+  }
+
+  DecisionTreeWalker(const DecisionTreeWalker &) = delete;
+  DecisionTreeWalker &operator=(const DecisionTreeWalker &) = delete;
+
+  // Moves to the next leaf.  Returns false once every leaf has been visited,
+  // once the meter has run out, or once the walk has had to give up for an
+  // enclosing search.
+  bool Next() {
+    if (abandoned_ || (started_ && !Backtrack())) {
+      return false;
+    }
+    started_ = true;
+    if (!Descend()) {
+      return false;
+    }
+    stats_.assignments_enumerated++;
+    return true;
+  }
+
+  // The value of the predicate at the current leaf.
+  const T &value() const { return value_; }
+
+  // The decisions leading to the current leaf, outermost first.  The leaf is
+  // the cylinder of sequences that agree with all of them.
+  const std::vector<Decision> &path() const { return path_; }
+
+  // Whether the walk gave up for an enclosing search, see SearchFrame.
+  bool abandoned() const { return abandoned_; }
+
+  // What the walk has cost so far.
+  SearchStats stats() const {
+    SearchStats stats = stats_;
+    stats.get_calls = sequence_.get_calls();
+    return stats;
+  }
+
+private:
+  // Pooled per thread, like ForSomeScratch.
+  struct State {
+    PartialAssignmentSequence sequence;
+    std::vector<Decision> path;
+  };
+
+  // Moves to the 1 branch of the deepest decision still on its 0 branch.
+  bool Backtrack() {
+    while (!path_.empty()) {
+      Decision &last = path_.back();
+      if (!last.value) {
+        last.value = true;
+        sequence_.Assign(last.index, true);
+        return true;
+      }
+      sequence_.Unassign(last.index);
+      path_.pop_back();
+    }
+    return false;
+  }
+
+  // Follows 0 branches from the current node down to a leaf.  Returns false
+  // if the meter ran out on the way, or if the walk had to give up for an
+  // enclosing search.
+  bool Descend() {
+    // Only lives while the predicate runs, so walkers that are not nested in
+    // each other's predicates can be interleaved.
+    SearchFrame frame(memo_);
+    sequence_.set_frame(&frame);
+    bool reached_leaf = Descend(&frame);
+    sequence_.set_frame(nullptr);
+    abandoned_ |= frame.abandoned();
+    return reached_leaf;
+  }
+
+  bool Descend(SearchFrame *frame) {
+    while (true) {
+      if (meter_ && !meter_->Charge()) {
+        return false;
+      }
+      sequence_.BeginEvaluation();
+      frame->BeginEvaluation();
+      stats_.predicate_invocations++;
+      TRACE_EVENT(kEvaluationBegin, 0);
+      std::optional<T> result;
+      {
+        PROFILE_DETAILED_SCOPE("predicate");
+        result = predicate_(&sequence_);
+      }
+      if (frame->ShouldAbandon()) {
+        return false;
+      }
+      if (frame->tainted()) {
+        result = std::nullopt;
+      }
+      TRACE_EVENT(kEvaluationEnd, result.has_value() ? 1 : 2);
+      if (result.has_value()) {
+        value_ = *result;
+        return true;
+      }
+
+      std::optional<Natural> idx = sequence_.requested_index();
+      if (!idx.has_value()) {
+        printf("Predicate returned the sentinel without reading a new bit!\n");
+        abort();
+      }
+      stats_.sentinel_restarts++;
+      stats_.indices_discovered++;
+      stats_.NoteIndex(*idx);
+      TRACE_EVENT(kIndexDiscovered, *idx);
+      path_.push_back({*idx, false});
+      sequence_.Assign(*idx, false);
+    }
+  }
+
+  PredicateTy predicate_;
+  BudgetMeter *meter_;
+  SearchMemo own_memo_;
+  SearchMemo *memo_;
+  PooledObject<State> state_;
+  PartialAssignmentSequence &sequence_ = state_->sequence;
+  std::vector<Decision> &path_ = state_->path;
+  T value_{};
+  bool started_ = false;
+  bool abandoned_ = false;
+  SearchStats stats_;
+};
+
+// If `meter` is set and runs out the result is meaningless.  If `witness` is
+// set and a leaf is found, it is set to the leaf.  Memoized calls share
+// `memo`, if set.
+template <typename PredicateTy>
+Bit ForSomeTreeSearchImpl(PredicateTy predicate, SearchStats *stats,
+                          BudgetMeter *meter, Cylinder *witness,
+                          SearchMemo *memo = nullptr) {
+  DecisionTreeWalker<Bit, PredicateTy> walker(std::move(predicate), meter,
+                                              memo);
+  bool found = false;
+  while (!found && walker.Next()) {
+    found = walker.value();
+  }
+  if (found) {
+    TRACE_EVENT(kWitnessFound, 0);
+    if (witness) {
+      witness->bits.clear();
+      for (const auto &decision : walker.path()) {
+        witness->bits.emplace_back(decision.index, decision.value);
+      }
+      std::sort(witness->bits.begin(), witness->bits.end());
+    }
+  }
+
+  SearchStats walk_stats = walker.stats();
+  walk_stats.searches = 0;
+  stats->Add(walk_stats);
+  return found;
+}
+
+// ForSome on top of DecisionTreeWalker.  Stops at the first leaf on which the
+// predicate is true.
+template <typename PredicateTy> Bit ForSomeTreeSearch(PredicateTy predicate) {
+  PROFILE_SCOPE("ForSomeTreeSearch");
+
+  SearchStatsRecorder stats;
+  TRACE_EVENT(kSearchBegin, 0);
+  Bit found =
+      ForSomeTreeSearchImpl(std::move(predicate), stats.get(), nullptr,
+                            /*witness=*/nullptr);
+  TRACE_EVENT(kSearchEnd, found);
+  return found;
+}
+
+// Enumerates the leaves of `predicate`'s decision tree on which it is true,
+// see AllWitnesses.
+template <typename PredicateTy> class WitnessEnumerator {
+public:
+  explicit WitnessEnumerator(PredicateTy predicate,
+                             BudgetMeter *meter = nullptr)
+      : walker_(std::move(predicate), meter) {}
+
+  WitnessEnumerator(const WitnessEnumerator &) = delete;
+  WitnessEnumerator &operator=(const WitnessEnumerator &) = delete;
+
+  // Records the walk as a single search, however far it got.
+  ~WitnessEnumerator() {
+    SearchStats stats = walker_.stats();
+    stats.searches = 1;
+    CollectSearchStats::Record(stats);
+  }
+
+  // Moves to the next cylinder.  Returns false once there are no more, or
+  // once the meter has run out.
+  bool Next() {
+    while (walker_.Next()) {
+      if (walker_.value()) {
+        TRACE_EVENT(kWitnessFound, 0);
+        cylinder_.bits.clear();
+        for (const auto &decision : walker_.path()) {
+          cylinder_.bits.emplace_back(decision.index, decision.value);
+        }
+        std::sort(cylinder_.bits.begin(), cylinder_.bits.end());
+        return true;
+      }
+    }
+    return false;
+  }
+
+  const Cylinder &cylinder() const { return cylinder_; }
+
+  SearchStats stats() const { return walker_.stats(); }
+
+private:
+  DecisionTreeWalker<Bit, PredicateTy> walker_;
+  Cylinder cylinder_;
+};
+
+// Every cylinder on which `predicate` is true, one per call to Next:
+//
+//   auto witnesses = AllWitnesses(FuncF);
+//   while (witnesses.Next()) {
+//     witnesses.cylinder().Print(stdout);
+//   }
+//
+// The cylinders are the true leaves of the predicate's decision tree, so they
+// are disjoint and together cover exactly the sequences on which the
+// predicate is true.  Only the current path is kept, so each step takes
+// memory proportional to the depth of the tree, and stopping early costs
+// nothing.
+template <typename PredicateTy>
+WitnessEnumerator<PredicateTy> AllWitnesses(PredicateTy predicate) {
+  return WitnessEnumerator<PredicateTy>(std::move(predicate));
+}
+
+// An exact nonnegative dyadic rational, such as the measure of a union of
+// disjoint cylinders or the integral of a Natural-valued functional.  The
+// fractional part is stored as its binary expansion, so there is no limit on
+// the denominator: a cylinder fixing k bits has measure 2^-k for any k.  The
+// whole part must fit in a Natural.
+class DyadicRational {
+public:
+  // Zero.
+  DyadicRational() = default;
+
+  // `numerator` / 2^`k`.
+  static DyadicRational Of(Natural numerator, Natural k) {
+    DyadicRational value;
+    value.AddScaled(numerator, k);
+    return value;
+  }
+
+  // Adds 2^-`k`.
+  void AddPowerOfHalf(Natural k) {
+    if (k == 0) {
+      AddWhole(1);
+      return;
+    }
+    if (k >= digits_.size()) {
+      digits_.resize(k + 1, false);
+    }
+    for (; digits_[k]; k--) {
+      digits_[k] = false;
+      if (k == 1) {
+        AddWhole(1);
+        return;
+      }
+    }
+    digits_[k] = true;
+  }
+
+  // Adds `value` * 2^-`k`.
+  void AddScaled(Natural value, Natural k) {
+    for (Natural b = 0; b < 64 && value >> b; b++) {
+      if (!((value >> b) & 1)) {
+        continue;
+      }
+      if (b >= k) {
+        AddWhole(Natural(1) << (b - k));
+      } else {
+        AddPowerOfHalf(k - b);
+      }
+    }
+  }
+
+  DyadicRational &operator+=(const DyadicRational &other) {
+    DyadicRational addend = other;
+    AddWhole(addend.whole_);
+    for (Natural k = 1; k < addend.digits_.size(); k++) {
+      if (addend.digits_[k]) {
+        AddPowerOfHalf(k);
+      }
+    }
+    return *this;
+  }
+
+  // The value is numerator() / 2^exponent(), with the numerator odd unless
+  // the value is whole.  numerator() needs the numerator to fit in a word.
+  Natural exponent() const {
+    for (Natural k = digits_.size(); k > 1; k--) {
+      if (digits_[k - 1]) {
+        return k - 1;
+      }
+    }
+    return 0;
+  }
+
+  uint64_t numerator() const {
+    Natural e = exponent();
+    uint64_t numerator = whole_;
+    for (Natural k = 1; k <= e; k++) {
+      numerator = numerator << 1 | digits_[k];
+    }
+    return numerator;
+  }
+
+  double ToDouble() const {
+    double value = whole_;
+    for (Natural k = 1; k < digits_.size(); k++) {
+      if (digits_[k]) {
+        value += std::ldexp(1.0, -static_cast<int>(k));
+      }
+    }
+    return value;
+  }
+
+  bool operator<(const DyadicRational &other) const {
+    if (whole_ != other.whole_) {
+      return whole_ < other.whole_;
+    }
+    for (Natural k = 1, e = std::max(digits_.size(), other.digits_.size());
+         k < e; k++) {
+      if (Digit(k) != other.Digit(k)) {
+        return other.Digit(k);
+      }
+    }
+    return false;
+  }
+
+  bool operator==(const DyadicRational &other) const {
+    return !(*this < other) && !(other < *this);
+  }
+
+  // Prints the value as `numerator/2^exponent`, or as
+  // `whole + numerator/2^exponent` with the numerator of the fractional part
+  // in hex if the numerator does not fit in a word.
+  void Print(FILE *out) const {
+    Natural e = exponent();
+    if (e < 64 && (e == 0 || whole_ >> (64 - e) == 0)) {
+      fprintf(out, "%llu/2^%llu", static_cast<unsigned long long>(numerator()),
+              static_cast<unsigned long long>(e));
+      return;
+    }
+
+    if (whole_) {
+      fprintf(out, "%llu + ", static_cast<unsigned long long>(whole_));
+    }
+    // Hex digits of the fractional part's numerator, least significant
+    // first.
+    std::vector<char> hex;
+    for (Natural low = 0; low < e; low += 4) {
+      int digit = 0;
+      for (Natural bit = 0; bit < 4 && low + bit < e; bit++) {
+        digit |= digits_[e - low - bit] << bit;
+      }
+      hex.push_back("0123456789abcdef"[digit]);
+    }
+    while (hex.size() > 1 && hex.back() == '0') {
+      hex.pop_back();
+    }
+    fprintf(out, "0x");
+    for (auto it = hex.rbegin(); it != hex.rend(); ++it) {
+      fputc(*it, out);
+    }
+    fprintf(out, "/2^%llu", static_cast<unsigned long long>(e));
+  }
+
+private:
+  Bit Digit(Natural k) const { return k < digits_.size() && digits_[k]; }
+
+  void AddWhole(Natural n) {
+    if (whole_ + n < whole_) {
+      printf("DyadicRational overflowed!\n");
+      abort();
+    }
+    whole_ += n;
+  }
+
+  Natural whole_ = 0;
+
+  // `digits_[k]` is the digit worth 2^-k, for k >= 1.
+  std::vector<bool> digits_;
+};
+
+#define PRINT_DYADIC_EXPR(expr)                                                \
+  do {                                                                         \
+    DyadicRational __val = (expr);                                             \
+    printf("%s = ", #expr);                                                    \
+    __val.Print(stdout);                                                       \
+    printf(" (%g)\n", __val.ToDouble());                                       \
+  } while (false)
+
+// The fraction of Cantor space, under the uniform measure, on which
+// `predicate` is true.  Exact: this is a full walk of the predicate's
+// decision tree, the traversal ForSomeTreeSearch makes when it finds nothing,
+// adding up 2^-depth for every true leaf.
+template <typename PredicateTy> DyadicRational Measure(PredicateTy predicate) {
+  PROFILE_SCOPE("Measure");
+
+  SearchStatsRecorder stats;
+  TRACE_EVENT(kSearchBegin, 0);
+  DecisionTreeWalker<Bit, PredicateTy> walker(std::move(predicate));
+  DyadicRational measure;
+  while (walker.Next()) {
+    if (walker.value()) {
+      measure.AddPowerOfHalf(walker.path().size());
+    }
+  }
+  SearchStats walk_stats = walker.stats();
+  walk_stats.searches = 0;
+  stats->Add(walk_stats);
+  TRACE_EVENT(kSearchEnd, !(measure == DyadicRational()));
+  return measure;
+}
+
+// Walks `predicate`'s decision tree, adding up the measure of the leaves on
+// which it is true and of those on which it is false, until
+// `decide(true_measure, false_measure)` returns an answer.  `decide` must
+// answer once the two add up to 1.
+template <typename PredicateTy, typename DecideFnTy>
+Bit DecideOnMeasure(PredicateTy predicate, DecideFnTy decide) {
+  PROFILE_SCOPE("DecideOnMeasure");
+
+  SearchStatsRecorder stats;
+  TRACE_EVENT(kSearchBegin, 0);
+  DecisionTreeWalker<Bit, PredicateTy> walker(std::move(predicate));
+  DyadicRational true_measure, false_measure;
+  std::optional<Bit> answer;
+  while (!answer && walker.Next()) {
+    (walker.value() ? true_measure : false_measure)
+        .AddPowerOfHalf(walker.path().size());
+    answer = decide(true_measure, false_measure);
+  }
+  SearchStats walk_stats = walker.stats();
+  walk_stats.searches = 0;
+  stats->Add(walk_stats);
+  TRACE_EVENT(kSearchEnd, answer.value_or(false));
+  return answer.value_or(false);
+}
+
+// Whether Measure(`predicate`) >= `q`.  Stops as soon as the true leaves
+// seen so far reach `q`, or the false ones leave too little for them to.
+template <typename PredicateTy>
+Bit AtLeastMeasure(PredicateTy predicate, const DyadicRational &q) {
+  PROFILE_SCOPE("AtLeastMeasure");
+  DyadicRational one = DyadicRational::Of(1, 0);
+  return DecideOnMeasure(
+      std::move(predicate),
+      [&](const DyadicRational &true_measure,
+          const DyadicRational &false_measure) -> std::optional<Bit> {
+        if (!(true_measure < q)) {
+          return true;
+        }
+        DyadicRational reachable_if_false = false_measure;
+        reachable_if_false += q;
+        if (one < reachable_if_false) {
+          return false;
+        }
+        return std::nullopt;
+      });
+}
+
+// Whether `predicate` is true on more than half of Cantor space.  Stops as
+// soon as either side passes one half.
+template <typename PredicateTy> Bit Majority(PredicateTy predicate) {
+  PROFILE_SCOPE("Majority");
+  DyadicRational half = DyadicRational::Of(1, 1);
+  return DecideOnMeasure(
+      std::move(predicate),
+      [&](const DyadicRational &true_measure,
+          const DyadicRational &false_measure) -> std::optional<Bit> {
+        if (half < true_measure) {
+          return true;
+        }
+        if (!(false_measure < half)) {
+          return false;
+        }
+        return std::nullopt;
+      });
+}
+
+// Whether the set on which `predicate` holds is exactly one cylinder.  That
+// depends only on the set, not on how the predicate reads its bits.
+//
+// The true leaves seen so far all lie in the smallest cylinder containing
+// them, the bits they all agree on, which only grows as more are seen.  The
+// set is that cylinder iff its measure is the cylinder's 2^-k, so the walk
+// stops as soon as the false leaves seen leave less than 2^-k for it.
+template <typename PredicateTy> Bit ExistsUnique(PredicateTy predicate) {
+  PROFILE_SCOPE("ExistsUnique");
+
+  SearchStatsRecorder stats;
+  TRACE_EVENT(kSearchBegin, 0);
+  using Walker = DecisionTreeWalker<Bit, PredicateTy>;
+  Walker walker(std::move(predicate));
+  DyadicRational one = DyadicRational::Of(1, 0);
+  DyadicRational true_measure, false_measure;
+  std::optional<std::map<Natural, Bit>> enclosing;
+  bool possible = true;
+  while (possible && walker.Next()) {
+    const std::vector<typename Walker::Decision> &path = walker.path();
+    if (!walker.value()) {
+      false_measure.AddPowerOfHalf(path.size());
+    } else {
+      true_measure.AddPowerOfHalf(path.size());
+      std::map<Natural, Bit> leaf;
+      for (const auto &decision : path) {
+        leaf[decision.index] = decision.value;
+      }
+      if (!enclosing) {
+        enclosing = std::move(leaf);
+      } else {
+        for (auto it = enclosing->begin(); it != enclosing->end();) {
+          auto bit = leaf.find(it->first);
+          it = bit == leaf.end() || bit->second != it->second
+                   ? enclosing->erase(it)
+                   : std::next(it);
+        }
+      }
+    }
+    if (enclosing) {
+      DyadicRational needed = false_measure;
+      needed += DyadicRational::Of(1, enclosing->size());
+      possible = !(one < needed);
+    }
+  }
+  Bit unique = possible && !walker.abandoned() && enclosing &&
+               true_measure == DyadicRational::Of(1, enclosing->size());
+  SearchStats walk_stats = walker.stats();
+  walk_stats.searches = 0;
+  stats->Add(walk_stats);
+  TRACE_EVENT(kSearchEnd, unique);
+  return unique;
+}
+
+// The expected value of `fn`, whose values are Naturals or convertible to
+// them, under the uniform measure.  Exact, like Measure: each leaf of `fn`'s
+// decision tree adds its value times 2^-depth.
+template <typename T, typename FnTy> DyadicRational Integrate(FnTy fn) {
+  PROFILE_SCOPE("Integrate");
+
+  SearchStatsRecorder stats;
+  TRACE_EVENT(kSearchBegin, 0);
+  DecisionTreeWalker<T, FnTy> walker(std::move(fn));
+  DyadicRational integral;
+  while (walker.Next()) {
+    integral.AddScaled(static_cast<Natural>(walker.value()),
+                       walker.path().size());
+  }
+  SearchStats walk_stats = walker.stats();
+  walk_stats.searches = 0;
+  stats->Add(walk_stats);
+  TRACE_EVENT(kSearchEnd, 1);
+  return integral;
+}
+
+// The result of Sup or Inf: the extreme value and a cylinder on which the
+// functional takes it.
+struct Extremum {
+  Natural value = 0;
+  Cylinder cylinder;
+
+  // Whether the search gave up for an enclosing one, see SearchFrame, in
+  // which case the value and cylinder mean nothing.
+  bool abandoned = false;
+};
+
+// A view of `source` that appends every bit read through it to `read`.
+class ReadRecordingBitSequence : public BitSequence {
+public:
+  ReadRecordingBitSequence(BitSequence *source, Cylinder *read)
+      : source_(source), read_(read) {
+    read_->bits.clear();
+  }
+  virtual ~ReadRecordingBitSequence() override {}
+
+  std::optional<Bit> Get(Natural idx) override {
+    std::optional<Bit> bit = source_->Get(idx);
+    if (!bit.has_value()) {
+      sentinel_returned_ = true;
+      return std::nullopt;
+    }
+    read_->bits.emplace_back(idx, *bit);
+    return bit;
+  }
+
+  // Whether `source` returned the sentinel for some read.
+  bool sentinel_returned() const { return sentinel_returned_; }
+
+private:
+  BitSequence *source_;
+  Cylinder *read_;
+  bool sentinel_returned_ = false;
+};
+
+// Branch and bound over `fn`'s decision tree, for the value that is best
+// according to `better`.  At every internal node `bound` is given the
+// cylinder of the node, sorted, and must return a value no worse than any
+// `fn` takes on it; the subtree is skipped if that cannot beat the best value
+// found so far.
+template <typename FnTy, typename BoundFnTy, typename BetterTy>
+Extremum BranchAndBound(FnTy fn, BoundFnTy bound, BetterTy better) {
+  PROFILE_SCOPE("BranchAndBound");
+
+  SearchStatsRecorder stats;
+  TRACE_EVENT(kSearchBegin, 0);
+  std::optional<Extremum> best;
+  Cylinder node;
+  bool pruned = false;
+  auto bounded_fn = [&](BitSequence *sequence) -> std::optional<Natural> {
+    pruned = false;
+    ReadRecordingBitSequence recording(sequence, &node);
+    std::optional<Natural> value = fn(&recording);
+    if (value || !best) {
+      return value;
+    }
+
+    std::sort(node.bits.begin(), node.bits.end());
+    node.bits.erase(std::unique(node.bits.begin(), node.bits.end()),
+                    node.bits.end());
+    if (better(static_cast<Natural>(bound(node)), best->value)) {
+      return std::nullopt;
+    }
+    // A leaf standing in for the subtree.
+    pruned = true;
+    return 0;
+  };
+
+  DecisionTreeWalker<Natural, decltype(bounded_fn)> walker(bounded_fn);
+  while (walker.Next()) {
+    if (pruned || (best && !better(walker.value(), best->value))) {
+      continue;
+    }
+    best = Extremum{walker.value(), {}};
+    for (const auto &decision : walker.path()) {
+      best->cylinder.bits.emplace_back(decision.index, decision.value);
+    }
+    std::sort(best->cylinder.bits.begin(), best->cylinder.bits.end());
+  }
+  SearchStats walk_stats = walker.stats();
+  walk_stats.searches = 0;
+  stats->Add(walk_stats);
+  TRACE_EVENT(kSearchEnd, 1);
+  if (walker.abandoned() || !best) {
+    Extremum abandoned;
+    abandoned.abandoned = true;
+    return abandoned;
+  }
+  return *best;
+}
+
+// The largest value of `fn`, whose values are Naturals or convertible to
+// them, and where it is taken.  `upper_bound(cylinder)` must be at least
+// every value `fn` takes on `cylinder`; the tighter it is, the more of the
+// tree is skipped.
+template <typename FnTy, typename BoundFnTy>
+Extremum Sup(FnTy fn, BoundFnTy upper_bound) {
+  PROFILE_SCOPE("Sup");
+  return BranchAndBound(std::move(fn), std::move(upper_bound),
+                        [](Natural a, Natural b) { return a > b; });
+}
+
+// Without a bound every leaf is visited.
+template <typename FnTy> Extremum Sup(FnTy fn) {
+  return Sup(std::move(fn), [](const Cylinder &) {
+    return std::numeric_limits<Natural>::max();
+  });
+}
+
+// The smallest value of `fn` and where it is taken.  `lower_bound(cylinder)`
+// must be at most every value `fn` takes on `cylinder`.
+template <typename FnTy, typename BoundFnTy>
+Extremum Inf(FnTy fn, BoundFnTy lower_bound) {
+  PROFILE_SCOPE("Inf");
+  return BranchAndBound(std::move(fn), std::move(lower_bound),
+                        [](Natural a, Natural b) { return a < b; });
+}
+
+// Without a bound the search still stops looking once it finds a 0.
+template <typename FnTy> Extremum Inf(FnTy fn) {
+  return Inf(std::move(fn), [](const Cylinder &) { return Natural(0); });
+}
+
+// The part of a function's decision tree that Memoized has seen so far.
+// Internal nodes are indices in the order the function read them, and leaves
+// hold its values.
+template <typename T> struct MemoTree {
+  struct Node {
+    Natural index = 0;
+
+    // Indices into `nodes`, or -1 for a branch not taken yet.
+    int children[2] = {-1, -1};
+
+    // Set on leaves.
+    std::optional<T> value;
+  };
+
+  // The root is nodes[0], once there is one.
+  std::vector<Node> nodes;
+};
+
+template <typename T> struct OptionalValue {
+  using type = T;
+};
+template <typename T> struct OptionalValue<std::optional<T>> {
+  using type = T;
+};
+
+// `T` for both `T` and `std::optional<T>`.
+template <typename T>
+using OptionalValueType = typename OptionalValue<T>::type;
+
+// Returns `fn(sequence)`, where `fn` returns a T or a std::optional<T>,
+// caching it the way a QBF solver caches the result of an inner quantifier:
+// if `fn` has already run during the current search, on a sequence that
+// agreed with this one on the bits it read, its result is reused.  This
+// makes a nested quantifier that reads few of the outer bits run once per
+// assignment to those bits, rather than once per evaluation of the outer
+// predicate.
+//
+//   ForEvery([](BitSequence *x) {
+//     return Memoized(x, [](BitSequence *x) {
+//       return ForSome([x](BitSequence *y) { ... });
+//     });
+//   });
+//
+// `fn` may not capture anything, so that its result depends on nothing but
+// the bits of `sequence` it reads; the results of a given `fn` are shared by
+// all its calls in the search.  It must read bits in an order that depends
+// only on the values of the bits read before, which holds for anything built
+// from this file's quantifiers.
+//
+// Looking up a result reads, through `sequence`, the bits `fn` read the last
+// time, so the enclosing search sees the same footprint as if `fn` had run.
+template <typename FnTy>
+auto Memoized(BitSequence *sequence, FnTy fn)
+    -> std::optional<OptionalValueType<decltype(fn(sequence))>> {
+  static_assert(std::is_empty_v<FnTy>,
+                "Memoized functions may not capture anything");
+  using T = OptionalValueType<decltype(fn(sequence))>;
+  using Node = typename MemoTree<T>::Node;
+
+  SearchFrame *frame = SearchFrame::active();
+  if (!frame) {
+    return fn(sequence);
+  }
+  std::vector<Node> &nodes =
+      frame->memo()->Table<MemoTree<T>>(typeid(FnTy))->nodes;
+
+  // Follows the branches this sequence takes down to a leaf, or to a branch
+  // that has not been taken yet.
+  int node = nodes.empty() ? -1 : 0;
+  int parent = -1;
+  Bit branch = false;
+  size_t depth = 0;
+  while (node >= 0 && !nodes[node].value.has_value()) {
+    ASSIGN_OR_RETURN(Bit, bit, sequence->Get(nodes[node].index));
+    parent = node;
+    branch = bit;
+    node = nodes[node].children[bit];
+    depth++;
+  }
+  if (node >= 0) {
+    return *nodes[node].value;
+  }
+
+  Cylinder read;
+  ReadRecordingBitSequence recording(sequence, &read);
+  std::optional<T> result = fn(&recording);
+  if (!result.has_value() || recording.sentinel_returned()) {
+    return result;
+  }
+
+  // Extends the tree with the new branch.  Repeated reads of an index add
+  // nothing, and the first `depth` distinct reads are the ones followed
+  // above.
+  auto add_node = [&](Node new_node) {
+    if (parent >= 0) {
+      nodes[parent].children[branch] = static_cast<int>(nodes.size());
+    }
+    nodes.push_back(std::move(new_node));
+    return static_cast<int>(nodes.size()) - 1;
+  };
+  std::vector<Natural> seen;
+  for (const auto &[idx, bit] : read.bits) {
+    if (std::find(seen.begin(), seen.end(), idx) != seen.end()) {
+      continue;
+    }
+    seen.push_back(idx);
+    if (seen.size() <= depth) {
+      continue;
+    }
+    Node new_node;
+    new_node.index = idx;
+    parent = add_node(std::move(new_node));
+    branch = bit;
+  }
+  if (seen.size() < depth) {
+    printf("Memoized function read fewer bits than it did before!\n");
+    abort();
+  }
+  Node leaf;
+  leaf.value = *result;
+  add_node(std::move(leaf));
+  return result;
+}
+
+// What a full walk of a predicate's decision tree is expected to cost, see
+// EstimateSearchCost.  `*_low` and `*_high` bound a 95% confidence interval.
+struct SearchCostEstimate {
+  // Probes that reached a leaf.  The estimates are 0 if there were none.
+  int probes = 0;
+
+  // Whether the estimate gave up for an enclosing search, see SearchFrame,
+  // and so covers fewer probes than were asked for.
+  bool abandoned = false;
+
+  // Nodes of the tree, internal and leaves.  DecisionTreeWalker evaluates the
+  // predicate once per node, so this is also the number of evaluations a
+  // ForSomeTreeSearch that finds no witness makes.
+  double evaluations = 0;
+  double evaluations_low = 0;
+  double evaluations_high = 0;
+
+  double leaves = 0;
+
+  // Gets made by those evaluations.
+  double get_calls = 0;
+  double get_calls_low = 0;
+  double get_calls_high = 0;
+
+  // The deepest leaf any probe reached.
+  int64_t max_depth = 0;
+};
+
+// Estimates the size of the decision tree `predicate` induces, without
+// walking it, with Knuth's estimator: each probe follows uniformly random
+// branches from the root to a leaf, and a node at depth d on the probe's
+// path stands in for the 2^d nodes at its depth.  The estimate is unbiased,
+// but on lopsided trees its variance is high and the confidence interval,
+// which assumes the mean of the probes is normally distributed, is only a
+// rough guide.
+//
+// This is the cost of exhausting the tree, i.e. the cost of a ForEvery that
+// holds or a ForSome that fails.  ForSome's enumeration pays 2^k evaluations
+// for k indices instead, so it is at least as expensive when the predicate
+// reads many distinct indices.
+template <typename PredicateTy>
+SearchCostEstimate EstimateSearchCost(PredicateTy predicate, int probes,
+                                      uint64_t seed) {
+  SearchFrame frame;
+  PooledObject<PartialAssignmentSequence> sequence;
+  std::mt19937_64 rng(seed);
+  double sums[3] = {0, 0, 0}, sums_of_squares[3] = {0, 0, 0};
+  SearchCostEstimate estimate;
+  for (int probe = 0; probe < probes && !estimate.abandoned; probe++) {
+    sequence->Clear();
+    sequence->set_frame(&frame);
+    double weight = 1, evaluations = 0, get_calls = 0;
+    int64_t depth = 0;
+    while (true) {
+      sequence->BeginEvaluation();
+      frame.BeginEvaluation();
+      int64_t get_calls_before = sequence->get_calls();
+      std::optional<Bit> result = predicate(&*sequence);
+      if (frame.ShouldAbandon()) {
+        estimate.abandoned = true;
+        break;
+      }
+      if (frame.tainted()) {
+        result = std::nullopt;
+      }
+      evaluations += weight;
+      get_calls += weight * (sequence->get_calls() - get_calls_before);
+      if (result.has_value()) {
+        break;
+      }
+
+      std::optional<Natural> idx = sequence->requested_index();
+      if (!idx.has_value()) {
+        printf("Predicate returned the sentinel without reading a new bit!\n");
+        abort();
+      }
+      sequence->Assign(*idx, rng() & 1);
+      weight *= 2;
+      depth++;
+    }
+
+    sequence->set_frame(nullptr);
+    if (estimate.abandoned) {
+      break;
+    }
+    estimate.probes++;
+    double values[3] = {evaluations, weight, get_calls};
+    for (int i = 0; i < 3; i++) {
+      sums[i] += values[i];
+      sums_of_squares[i] += values[i] * values[i];
+    }
+    estimate.max_depth = std::max(estimate.max_depth, depth);
+  }
+
+  if (estimate.probes == 0) {
+    return estimate;
+  }
+  const int completed = estimate.probes;
+
+  // Returns the mean of the `i`th value and the half width of its interval.
+  auto summarize = [&](int i, double *low, double *high) {
+    double mean = sums[i] / completed;
+    double variance =
+        completed > 1
+            ? std::max(sums_of_squares[i] - completed * mean * mean, 0.0) /
+                  (completed - 1)
+            : 0;
+    double half_width = 1.96 * std::sqrt(variance / completed);
+    if (low) {
+      *low = std::max(mean - half_width, 0.0);
+      *high = mean + half_width;
+    }
+    return mean;
+  };
+  estimate.evaluations =
+      summarize(0, &estimate.evaluations_low, &estimate.evaluations_high);
+  estimate.leaves = summarize(1, nullptr, nullptr);
+  estimate.get_calls =
+      summarize(2, &estimate.get_calls_low, &estimate.get_calls_high);
+  return estimate;
+}
+
+constexpr int64_t kMaxEnumeratedIndices = 64;
+
+// The containers ForSome works in.  These are pooled per thread so that their
+// capacity carries over from one search to the next.
+struct ForSomeScratch {
+  std::vector<bool> scratch;
+  SetOfNaturals indices_of_bits_present;
+  SetOfNaturals indices_of_bits_requested;
+  std::vector<Natural> indices_of_bits_present_vect;
+  std::vector<uint64_t> last_read_in_evaluation;
+
+  void Clear() {
+    scratch.clear();
+    indices_of_bits_present.Clear();
+    indices_of_bits_requested.Clear();
+  }
+};
+
+// ForSome enumerates every assignment to the indices the predicate has asked
+// for so far, restarting with a bigger index set whenever the predicate asks
+// for a new one.  A restart with k indices costs up to 2^k evaluations (fewer
+// when flips miss the predicate's footprint).  This works well for predicates
+// that read a few dozen bits in total.  The enumeration counter is a single
+// word, so once 64 or more indices have been discovered the search switches to
+// ForSomeTreeSearch, which has no such limit.
+//
+// If `meter` is set and runs out the result is meaningless.  If `witness` is
+// set and the predicate holds somewhere, it is set to the bits the predicate
+// read on the evaluation that returned true, so the predicate holds on all of
+// that cylinder.
+template <typename PredicateTy>
+Bit ForSomeImpl(PredicateTy predicate, SearchStats *stats, BudgetMeter *meter,
+                Cylinder *witness) {
+  SearchFrame frame;
+  PooledObject<ForSomeScratch> state;
+  state->Clear();
+  std::vector<bool> &scratch = state->scratch;
+  SetOfNaturals &indices_of_bits_present = state->indices_of_bits_present;
+  SetOfNaturals &indices_of_bits_requested = state->indices_of_bits_requested;
+  std::vector<Natural> &indices_of_bits_present_vect =
+      state->indices_of_bits_present_vect;
+  while (true) {
+    std::optional<Bit> result;
+    int64_t present_count = indices_of_bits_present.size();
+    if (present_count >= kMaxEnumeratedIndices) {
+      // The tree search's frames nest in this one, which must not look like
+      // it is in the middle of an evaluation.
+      frame.BeginEvaluation();
+      return ForSomeTreeSearchImpl(std::move(predicate), stats, meter,
+                                   witness, frame.memo());
+    } else if (present_count == static_cast<int64_t>(scratch.size())) {
+      PrefixBitSequence prefix_bit_stream(present_count,
+                                          &indices_of_bits_requested, &frame);
+      result = EnumerateAssignments(
+          &prefix_bit_stream, present_count, [](int slot) { return slot; },
+          predicate, stats, meter);
+      stats->get_calls += prefix_bit_stream.get_calls();
+      if (witness && result == std::optional<Bit>(true)) {
+        prefix_bit_stream.GetFootprint(witness);
+      }
+    } else {
+      indices_of_bits_present_vect.clear();
+      indices_of_bits_present.ForEach(
+          [&](Natural n) { indices_of_bits_present_vect.push_back(n); });
+      scratch.assign(scratch.size(), false);
+      LazyBitSequence lazy_bit_stream(&scratch, &indices_of_bits_present,
+                                      &indices_of_bits_requested,
+                                      &state->last_read_in_evaluation, &frame);
+      result = EnumerateAssignments(
+          &lazy_bit_stream, present_count,
+          [&](int slot) { return indices_of_bits_present_vect[slot]; },
+          predicate, stats, meter);
+      stats->get_calls += lazy_bit_stream.get_calls();
+      if (witness && result == std::optional<Bit>(true)) {
+        lazy_bit_stream.GetFootprint(witness);
+      }
+    }
+
+    if (result.has_value() || (meter && meter->exhausted()) ||
+        frame.abandoned()) {
+      return result.value_or(false);
+    }
+
+    // The search did not give up, so the sentinel came from this search's own
+    // sequence, and the bits it asked for are in `indices_of_bits_requested`
+    // rather than in some enclosing search's set.
+    stats->sentinel_restarts++;
+    Natural new_scratch_size = scratch.size();
+    indices_of_bits_requested.ForEach([&](Natural requested_index) {
+      TRACE_EVENT(kIndexDiscovered, requested_index);
+      stats->indices_discovered += !indices_of_bits_present.Contains(
+          requested_index);
+      stats->NoteIndex(requested_index);
+      indices_of_bits_present.Insert(requested_index);
+      new_scratch_size = std::max(new_scratch_size, requested_index + 1);
+    });
+    scratch.resize(new_scratch_size);
+    indices_of_bits_requested.Clear();
+    TRACE_EVENT(kRestart, indices_of_bits_present.size());
+  }
+}
+
+// ForSome, charging every evaluation to `meter` if it is set.  Returns
+// kUnknown if the meter runs out first.  On kTrue, `witness`, if set, holds a
+// cylinder on which the predicate is true.
+template <typename PredicateTy>
+Truth ForSomeWithin(PredicateTy predicate, BudgetMeter *meter,
+                    Cylinder *witness = nullptr) {
+  PROFILE_SCOPE("ForSome");
+
+  SearchStatsRecorder stats;
+  TRACE_EVENT(kSearchBegin, 0);
+  Bit found = ForSomeImpl(std::move(predicate), stats.get(), meter, witness);
+  Truth truth = meter && meter->exhausted() ? Truth::kUnknown : ToTruth(found);
+  TRACE_EVENT(kSearchEnd, static_cast<int>(truth));
+  return truth;
+}
+
+template <typename PredicateTy> Bit ForSome(PredicateTy predicate) {
+  return ForSomeWithin(std::move(predicate), nullptr) == Truth::kTrue;
+}
+
+// ForSome that also says where: returns a cylinder on which the predicate is
+// true, or nothing if there is none.  The cylinder is what the search was
+// looking at when it stopped, so finding it costs nothing over ForSome.
+template <typename PredicateTy>
+std::optional<Cylinder> Find(PredicateTy predicate) {
+  Cylinder witness;
+  if (ForSomeWithin(std::move(predicate), nullptr, &witness) != Truth::kTrue) {
+    return std::nullopt;
+  }
+  return witness;
+}
+
+template <typename PredicateTy> auto Negation(PredicateTy pred) {
+  return [=](BitSequence *c) -> std::optional<Bit> {
+    ASSIGN_OR_RETURN(Bit, val, pred(c));
+    return !val;
+  };
+}
+
+template <typename PredicateTy> Bit ForEvery(PredicateTy pred) {
+  return !ForSome(Negation(pred));
+}
+
+template <typename PredicateTy>
+Truth ForEveryWithin(PredicateTy pred, BudgetMeter *meter) {
+  return Not(ForSomeWithin(Negation(pred), meter));
+}
+
+// Runs `fn(&meter)`, where `fn` returns a Truth, with a fresh meter for
+// `budget`, and collects the stats of the searches it makes.
+template <typename FnTy>
+BoundedTruth RunWithinBudget(const SearchBudget &budget, FnTy fn) {
+  BoundedTruth result;
+  {
+    CollectSearchStats collect(&result.stats);
+    BudgetMeter meter(budget);
+    result.truth = fn(&meter);
+  }
+  return result;
+}
+
+// The bounded quantifiers.  Each gives up with kUnknown once `budget` is
+// exhausted, which it notices between two evaluations of the predicate.
+template <typename PredicateTy>
+BoundedTruth ForSome(PredicateTy predicate, const SearchBudget &budget) {
+  return RunWithinBudget(budget, [&](BudgetMeter *meter) {
+    return ForSomeWithin(std::move(predicate), meter);
+  });
+}
+
+template <typename PredicateTy>
+BoundedTruth ForEvery(PredicateTy pred, const SearchBudget &budget) {
+  return RunWithinBudget(budget, [&](BudgetMeter *meter) {
+    return ForEveryWithin(std::move(pred), meter);
+  });
+}
+
+// Maps indices of a view to indices of the sequence it is a view of.
+//
+// Every map has the same shape: an explicit table for indices below some
+// threshold and, past that, one affine function per residue class modulo some
+// period P:
+//
+//   Apply(i) = table[i]                                 if i < table.size()
+//   Apply(i) = stride[i % P] * (i / P) + offset[i % P]  otherwise
+//
+// Maps of this shape are closed under composition and interleaving, which is
+// what lets a stack of views over one sequence collapse into a single map.
+// Plain affine maps (no table, P = 1) are by far the most common and are kept
+// inline; everything else lives in a shared, immutable `Pieces`.
+class IndexMap {
+public:
+  // Maps `i` to `stride * i + offset`.
+  static IndexMap Affine(Natural stride, Natural offset) {
+    IndexMap map;
+    map.stride_ = stride;
+    map.offset_ = offset;
+    return map;
+  }
+
+  static IndexMap Identity() { return Affine(/*stride=*/1, /*offset=*/0); }
+
+  // Maps `i` to `permutation[i]` for `i < permutation.size()` and to `i`
+  // otherwise.  `permutation` is expected to be a permutation of
+  // [0, permutation.size()), but any finite remapping works.
+  static IndexMap Permutation(std::vector<Natural> permutation) {
+    Pieces pieces;
+    pieces.table = std::move(permutation);
+    pieces.strides = {1};
+    pieces.offsets = {0};
+    return FromPieces(std::move(pieces));
+  }
+
+  // Returns the map `i -> second.Apply(first.Apply(i))`.
+  static IndexMap Compose(const IndexMap &first, const IndexMap &second) {
+    if (first.IsAffine() && second.IsAffine()) {
+      return Affine(second.stride_ * first.stride_,
+                    second.stride_ * first.offset_ + second.offset_);
+    }
+
+    // Past `threshold` every index lands in the affine part of `first` and
+    // then in the affine part of `second`, after which the composition is
+    // affine on residues modulo `first.Period() * second.Period()`.
+    Natural threshold = first.Threshold();
+    for (Natural r = 0; r < first.Period(); r++) {
+      Natural stride = first.StrideFor(r), offset = first.OffsetFor(r);
+      if (stride == 0 || offset >= second.Threshold()) {
+        continue;
+      }
+      Natural min_q = (second.Threshold() - offset + stride - 1) / stride;
+      threshold = std::max(threshold, first.Period() * min_q + r);
+    }
+
+    return Tabulate(
+        first.Period() * second.Period(), threshold,
+        [&](Natural idx) { return second.Apply(first.Apply(idx)); });
+  }
+
+  // Returns the map that sends `maps.size() * q + j` to `maps[j].Apply(q)`.
+  // `maps` must not be empty.
+  static IndexMap Interleave(const std::vector<IndexMap> &maps) {
+    if (maps.empty()) {
+      printf("Interleaved no index maps!\n");
+      abort();
+    }
+    Natural n = maps.size();
+    Natural period = 1, threshold = 0;
+    for (Natural j = 0; j < n; j++) {
+      period = std::lcm(period, maps[j].Period());
+      if (maps[j].Threshold() != 0) {
+        threshold = std::max(threshold, n * (maps[j].Threshold() - 1) + j + 1);
+      }
+    }
+
+    return Tabulate(n * period, threshold, [&](Natural idx) {
+      return maps[idx % n].Apply(idx / n);
+    });
+  }
+
+  Natural Apply(Natural idx) const {
+    if (!pieces_) {
+      return stride_ * idx + offset_;
+    }
+    return pieces_->Apply(idx);
+  }
+
+  bool IsAffine() const { return !pieces_; }
+
+private:
+  struct Pieces {
+    std::vector<Natural> table;
+    Natural period = 1;
+    std::vector<Natural> strides;
+    std::vector<Natural> offsets;
+
+    Natural Apply(Natural idx) const {
+      if (idx < table.size()) {
+        return table[idx];
+      }
+      return ApplyAffinePart(idx);
+    }
+
+    Natural ApplyAffinePart(Natural idx) const {
+      Natural r = idx % period;
+      return strides[r] * (idx / period) + offsets[r];
+    }
+  };
+
+  Natural Threshold() const { return pieces_ ? pieces_->table.size() : 0; }
+  Natural Period() const { return pieces_ ? pieces_->period : 1; }
+  Natural StrideFor(Natural r) const {
+    return pieces_ ? pieces_->strides[r] : stride_;
+  }
+  Natural OffsetFor(Natural r) const {
+    return pieces_ ? pieces_->offsets[r] : offset_;
+  }
+
+  // Builds the map for `fn`, which the caller guarantees has the shape
+  // described above with the given `period` for indices >= `threshold`.  The
+  // affine pieces are recovered by evaluating `fn` twice per residue.
+  template <typename FnTy>
+  static IndexMap Tabulate(Natural period, Natural threshold, FnTy fn) {
+    Pieces pieces;
+    pieces.period = period;
+    pieces.strides.resize(period);
+    pieces.offsets.resize(period);
+    for (Natural r = 0; r < period; r++) {
+      Natural q = threshold > r ? (threshold - r + period - 1) / period : 0;
+      Natural at_q = fn(period * q + r);
+      pieces.strides[r] = fn(period * (q + 1) + r) - at_q;
+      pieces.offsets[r] = at_q - pieces.strides[r] * q;
+    }
+
+    pieces.table.resize(threshold);
+    for (Natural i = 0; i < threshold; i++) {
+      pieces.table[i] = fn(i);
+    }
+
+    return FromPieces(std::move(pieces));
+  }
+
+  static IndexMap FromPieces(Pieces pieces) {
+    ReducePeriod(&pieces);
+
+    // Drop table entries that agree with the affine part.
+    while (!pieces.table.empty() &&
+           pieces.table.back() ==
+               pieces.ApplyAffinePart(pieces.table.size() - 1)) {
+      pieces.table.pop_back();
+    }
+
+    if (pieces.table.empty() && pieces.period == 1) {
+      return Affine(pieces.strides[0], pieces.offsets[0]);
+    }
+
+    IndexMap map;
+    map.pieces_ = std::make_shared<const Pieces>(std::move(pieces));
+    return map;
+  }
+
+  // Replaces the period by its smallest divisor that describes the same
+  // affine part.  Without this interleaving views of views would keep
+  // multiplying the period.
+  static void ReducePeriod(Pieces *pieces) {
+    Natural period = pieces->period;
+    std::vector<Natural> &strides = pieces->strides;
+    std::vector<Natural> &offsets = pieces->offsets;
+    for (Natural d = 1; d < period; d++) {
+      if (period % d != 0) {
+        continue;
+      }
+
+      Natural k = period / d;
+      bool describes_same_map = true;
+      for (Natural r = 0; r < period && describes_same_map; r++) {
+        Natural t = r % d;
+        describes_same_map =
+            strides[t] % k == 0 && strides[r] == strides[t] &&
+            offsets[r] == strides[t] / k * (r / d) + offsets[t];
+      }
+      if (!describes_same_map) {
+        continue;
+      }
+
+      for (Natural t = 0; t < d; t++) {
+        strides[t] /= k;
+      }
+      strides.resize(d);
+      offsets.resize(d);
+      pieces->period = d;
+      return;
+    }
+  }
+
+  Natural stride_ = 1;
+  Natural offset_ = 0;
+  std::shared_ptr<const Pieces> pieces_;
+};
+
+// A view that reads bit `I` from bit `map.Apply(I)` of `source`.
+//
+// Views constructed on top of other views fold the two maps into one, so a
+// Get on an arbitrarily deep stack of views costs one map evaluation and one
+// call into the sequence at the bottom of the stack.  The bottom sequence has
+// to outlive the view, but the intermediate views do not.
+class MappedBitSequence : public BitSequence {
+public:
+  MappedBitSequence(BitSequence *source, IndexMap map)
+      : root_(source), map_(std::move(map)) {
+    if (MappedBitSequence *source_view = source->AsMappedView()) {
+      root_ = source_view->root_;
+      map_ = IndexMap::Compose(map_, source_view->map_);
+    }
+  }
+
+  std::optional<Bit> Get(Natural idx) override {
+    return root_->Get(map_.Apply(idx));
+  }
+
+  MappedBitSequence *AsMappedView() override { return root_ ? this : nullptr; }
+
+  // The non-view sequence this view reads from and the map into it.
+  BitSequence *root() const { return root_; }
+  const IndexMap &map() const { return map_; }
+
+protected:
+  MappedBitSequence() = default;
+
+  // Null for views that could not be folded, see InterleavedBitSequence.
+  BitSequence *root_ = nullptr;
+  IndexMap map_;
+};
+
+// Can be used to map a single bit sequence into N bit sequences, each reading
+// mapping bit `I` to bit `N*I+J` in the main sequence, with 0 <= `J` < N.
+class StridedBitSequence : public MappedBitSequence {
+public:
+  StridedBitSequence(BitSequence *source, Natural stride, Natural offset)
+      : MappedBitSequence(source, IndexMap::Affine(stride, offset)) {}
+};
+
+// Maps bit `I` to bit `I+shift` of `source`, i.e. drops the first `shift` bits.
+class ShiftedBitSequence : public MappedBitSequence {
+public:
+  ShiftedBitSequence(BitSequence *source, Natural shift)
+      : MappedBitSequence(source, IndexMap::Affine(/*stride=*/1, shift)) {}
+};
+
+// Maps bit `I` to bit `permutation[I]` of `source`, and leaves bits past the
+// end of `permutation` in place.
+class PermutedBitSequence : public MappedBitSequence {
+public:
+  PermutedBitSequence(BitSequence *source, std::vector<Natural> permutation)
+      : MappedBitSequence(source,
+                          IndexMap::Permutation(std::move(permutation))) {}
+};
+
+// The inverse of StridedBitSequence: maps bit `N*I+J` to bit `I` of
+// `sources[J]`, with N = `sources.size()`, which must not be 0.
+//
+// If all of `sources` are views of the same sequence (or that sequence itself)
+// this folds into a single map like the other views.  Otherwise each Get
+// dispatches to the right source, and views built on top of this one cannot
+// see through it.
+class InterleavedBitSequence : public MappedBitSequence {
+public:
+  explicit InterleavedBitSequence(std::vector<BitSequence *> sources) {
+    if (sources.empty()) {
+      printf("Interleaved no sequences!\n");
+      abort();
+    }
+    std::vector<IndexMap> maps;
+    BitSequence *common_root = nullptr;
+    for (BitSequence *source : sources) {
+      MappedBitSequence *source_view = source->AsMappedView();
+      BitSequence *root = source;
+      IndexMap map = IndexMap::Identity();
+      if (source_view) {
+        root = source_view->root();
+        map = source_view->map();
+      }
+
+      if (common_root && root != common_root) {
+        sources_ = std::move(sources);
+        return;
+      }
+      common_root = root;
+      maps.push_back(std::move(map));
+    }
+
+    root_ = common_root;
+    map_ = IndexMap::Interleave(maps);
+  }
+
+  std::optional<Bit> Get(Natural idx) override {
+    if (root_) {
+      return MappedBitSequence::Get(idx);
+    }
+    return sources_[idx % sources_.size()]->Get(idx / sources_.size());
+  }
+
+private:
+  // Only populated if the sources could not be folded.
+  std::vector<BitSequence *> sources_;
+};
+
+// Turns a predicate on two sequences into a predicate on the sequence that
+// interleaves them.
+template <typename Predicate2Ty> auto OnProduct(Predicate2Ty pred) {
+  return [=](BitSequence *product) {
+    StridedBitSequence a(product, /*stride=*/2, /*offset=*/0);
+    StridedBitSequence b(product, /*stride=*/2, /*offset=*/1);
+    return pred(&a, &b);
+  };
+}
+
+template <typename Predicate2Ty> Bit ForEvery2(Predicate2Ty pred) {
+  return ForEvery(OnProduct(pred));
+}
+
+template <typename T, typename PredicateTy>
+auto AgreeOn(PredicateTy f_a, PredicateTy f_b) {
+  return [=](BitSequence *idx) -> std::optional<Bit> {
+    ASSIGN_OR_RETURN(T, a, f_a(idx));
+    ASSIGN_OR_RETURN(T, b, f_b(idx));
+    return a == b;
+  };
+}
+
+template <typename T, typename PredicateTy>
+Bit Equal(PredicateTy f_a, PredicateTy f_b) {
+  PROFILE_COUNTED_SCOPE("Equal");
+  return ForEvery(AgreeOn<T>(f_a, f_b));
+}
+
+template <typename T, typename PredicateTy>
+BoundedTruth Equal(PredicateTy f_a, PredicateTy f_b,
+                   const SearchBudget &budget) {
+  PROFILE_COUNTED_SCOPE("Equal");
+  return ForEvery(AgreeOn<T>(f_a, f_b), budget);
+}
+
+// Why Equal<T>(`f_a`, `f_b`) is false: a cylinder on which the two differ,
+// or nothing if they are equal.
+template <typename T, typename PredicateTy>
+std::optional<Cylinder> FindDisagreement(PredicateTy f_a, PredicateTy f_b) {
+  PROFILE_COUNTED_SCOPE("FindDisagreement");
+  return Find(Negation(AgreeOn<T>(f_a, f_b)));
+}
+
+// How different `f_a` and `f_b` are: the measure of the sequences on which
+// they disagree, 0 if and only if Equal<T>(`f_a`, `f_b`).
+template <typename T, typename PredicateTy>
+DyadicRational DisagreementMeasure(PredicateTy f_a, PredicateTy f_b) {
+  PROFILE_COUNTED_SCOPE("DisagreementMeasure");
+  return Measure(Negation(AgreeOn<T>(f_a, f_b)));
+}
+
+template <typename PredicateNoOptionalTy>
+Natural Least(PredicateNoOptionalTy fn) {
+  Natural i = 0;
+  while (!fn(i)) {
+    i++;
+  }
+  return i;
+}
+
+inline std::optional<bool> Eq(Natural n, BitSequence *a, BitSequence *b) {
+  for (Natural i = 0; i < n; i++) {
+    ASSIGN_OR_RETURN(Bit, ai, a->Get(i));
+    ASSIGN_OR_RETURN(Bit, bi, b->Get(i));
+    if (ai != bi) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// True on pairs of sequences that `fn` does not tell apart unless they differ
+// in their first `n` bits.
+template <typename T, typename PredicateTy>
+auto ModulusCheck(PredicateTy fn, Natural n) {
+  return [=](BitSequence *a, BitSequence *b) -> std::optional<Bit> {
+    ASSIGN_OR_RETURN(bool, equal, Eq(n, a, b));
+    if (!equal) {
+      return true;
+    }
+
+    ASSIGN_OR_RETURN(T, fa, fn(a));
+    ASSIGN_OR_RETURN(T, fb, fn(b));
+    return fa == fb;
+  };
+}
+
+template <typename T, typename PredicateTy> Natural Modulus(PredicateTy fn) {
+  PROFILE_COUNTED_SCOPE("Modulus");
+  auto is_modulus = [=](Natural n) {
+    return ForEvery2(ModulusCheck<T>(fn, n));
+  };
+  return Least(is_modulus);
+}
+
+template <typename T, typename PredicateTy>
+BoundedNatural Modulus(PredicateTy fn, const SearchBudget &budget) {
+  PROFILE_COUNTED_SCOPE("Modulus");
+  BoundedNatural result;
+  {
+    CollectSearchStats collect(&result.stats);
+    BudgetMeter meter(budget);
+    for (Natural n = 0;; n++) {
+      Truth is_modulus =
+          ForEveryWithin(OnProduct(ModulusCheck<T>(fn, n)), &meter);
+      if (is_modulus != Truth::kFalse) {
+        if (is_modulus == Truth::kTrue) {
+          result.value = n;
+        }
+        break;
+      }
+    }
+  }
+  return result;
+}
+
+// The example predicates from the blog post, used by the tests and the
+// benchmarks.
+inline std::optional<Bit> FuncF(BitSequence *a) {
+  ASSIGN_OR_RETURN(Bit, t0, a->Get(4));
+  ASSIGN_OR_RETURN(Bit, t1, a->Get(t0 * 7));
+  ASSIGN_OR_RETURN(Bit, t2, a->Get(7));
+  return t0 * 7 + t1 * t2;
+}
+
+inline std::optional<Bit> FuncG(BitSequence *a) {
+  ASSIGN_OR_RETURN(Bit, t0, a->Get(4));
+  ASSIGN_OR_RETURN(Bit, t1, a->Get(7));
+  ASSIGN_OR_RETURN(Bit, t2, a->Get(t0 + 11 * t1));
+  return t2 * t0;
+}
+
+#endif
@@ -1,272 +1,779 @@
 #include <array>
 #include <chrono>
-#include <cstdint>
+#include <cmath>
 #include <cstdio>
-#include <memory>
+#include <cstdlib>
+#include <cstring>
 #include <optional>
-#include <string>
-#include <unordered_set>
 #include <vector>
 
+#include "approx_measure.h"
+#include "async.h"
+#include "batch.h"
+#include "impossible.h"
+#include "profiler.h"
+#include "random_predicate.h"
+#include "trace.h"
 #include "utils.h"
 
-using Bit = bool;
-using Natural = uint64_t;
+void TestA() {
+  PROFILE_COUNTED_SCOPE(__func__);
+
+  PRINT_BIT_EXPR(Equal<Bit>(FuncF, FuncF));
+  PRINT_BIT_EXPR(Equal<Bit>(FuncG, FuncG));
 
-// Set of natural numbers, implemented as a bitset.
-class SetOfNaturals {
-public:
-  void Clear() { rep_.clear(); }
+  PRINT_BIT_EXPR(Equal<Bit>(FuncF, FuncG));
+  PRINT_BIT_EXPR(Equal<Bit>(FuncG, FuncF));
 
-  void Insert(Natural idx) {
-    if (idx >= rep_.size()) {
-      rep_.resize(idx + 1, false);
+  PRINT_NAT_EXPR(Modulus<Bit>(FuncF));
+  PRINT_NAT_EXPR(Modulus<Bit>(FuncG));
+}
+
+// Checks that `view` is a single folded view of `source` that maps bit `I` to
+// bit `expected_index(I)`, for all `I` < `n`.
+template <typename IndexFnTy>
+std::optional<Bit> IsFoldedView(Natural n, MappedBitSequence *view,
+                                BitSequence *source, IndexFnTy expected_index) {
+  if (view->root() != source) {
+    return false;
+  }
+
+  for (Natural i = 0; i < n; i++) {
+    ASSIGN_OR_RETURN(Bit, actual, view->Get(i));
+    ASSIGN_OR_RETURN(Bit, expected, source->Get(expected_index(i)));
+    if (actual != expected) {
+      return false;
     }
-    size_ += !rep_[idx];
-    rep_[idx] = true;
   }
 
-  bool Contains(Natural idx) const { return idx < rep_.size() && rep_[idx]; }
+  return true;
+}
+
+std::optional<Bit> StridedOfStridedFolds(BitSequence *s) {
+  StridedBitSequence odd(s, /*stride=*/2, /*offset=*/1);
+  StridedBitSequence view(&odd, /*stride=*/3, /*offset=*/2);
+  return IsFoldedView(4, &view, s, [](Natural i) { return 6 * i + 5; });
+}
 
-  template <typename FnTy> void ForEach(FnTy func) {
-    for (Natural i = 0, e = rep_.size(); i < e; i++) {
-      if (rep_[i]) {
-        func(i);
+std::optional<Bit> InterleavedStridesFold(BitSequence *s) {
+  StridedBitSequence even(s, /*stride=*/2, /*offset=*/0);
+  StridedBitSequence odd(s, /*stride=*/2, /*offset=*/1);
+  InterleavedBitSequence view({&even, &odd});
+  return IsFoldedView(6, &view, s, [](Natural i) { return i; });
+}
+
+std::optional<Bit> MixedViewsFold(BitSequence *s) {
+  ShiftedBitSequence shifted(s, /*shift=*/3);
+  PermutedBitSequence swapped(&shifted, {1, 0});
+  StridedBitSequence other(s, /*stride=*/3, /*offset=*/1);
+  InterleavedBitSequence view({&swapped, &other});
+  std::array<Natural, 6> expected = {4, 1, 3, 4, 5, 7};
+  return IsFoldedView(6, &view, s, [&](Natural i) { return expected[i]; });
+}
+
+void TestViews() {
+  PROFILE_COUNTED_SCOPE(__func__);
+
+  PRINT_BIT_EXPR(ForEvery(StridedOfStridedFolds));
+  PRINT_BIT_EXPR(ForEvery(InterleavedStridesFold));
+  PRINT_BIT_EXPR(ForEvery(MixedViewsFold));
+}
+
+// Returns a predicate that is true iff the first `n` bits are all zero.
+auto FirstBitsAreZero(Natural n) {
+  return [n](BitSequence *a) -> std::optional<Bit> {
+    for (Natural i = 0; i < n; i++) {
+      ASSIGN_OR_RETURN(Bit, bit, a->Get(i));
+      if (bit) {
+        return false;
       }
     }
-  }
+    return true;
+  };
+}
 
-  int64_t size() const { return size_; }
-
-private:
-  int64_t size_ = 0;
-  std::vector<bool> rep_;
-};
-
-// A possibly infinite sequence of bits.
-class BitSequence {
-public:
-  // Subclasses override this method to provide class specific functionality.
-  //
-  // Either returns a bit or a sentinel value (std::optional).
-  virtual std::optional<Bit> Get(Natural) = 0;
-  virtual ~BitSequence() {}
-};
-
-// This bit sequence contains a finite prefix of an infinite bit sequence.
-//
-// If the caller asks for bits beyond the prefix it was told about, it returns
-// the sentinel.  It also keeps track of the indices that it returned sentinel
-// for.
-class LazyBitSequence : public BitSequence {
-public:
-  explicit LazyBitSequence(const std::vector<Bit> *values,
-                           const SetOfNaturals *indices_present,
-                           SetOfNaturals *unfulfilled_indices)
-      : values_(*values), indices_present_(*indices_present),
-        unfulfilled_indices_(unfulfilled_indices) {}
-  virtual ~LazyBitSequence() override {}
-
-  std::optional<Bit> Get(Natural idx) override {
-    if (indices_present_.Contains(idx)) {
-      return values_[idx];
+// Returns a predicate that is true iff the first one bit is bit `n - 1`.
+auto FirstOneIsBit(Natural n) {
+  return [n](BitSequence *a) -> std::optional<Bit> {
+    for (Natural i = 0; i < n; i++) {
+      ASSIGN_OR_RETURN(Bit, bit, a->Get(i));
+      if (bit) {
+        return i == n - 1;
+      }
     }
+    return false;
+  };
+}
 
-    unfulfilled_indices_->Insert(idx);
-    return std::nullopt;
+// These predicates make ForSome discover 64 or more indices, which is where it
+// hands over from enumeration to tree search.
+void TestLargeIndexSets() {
+  PROFILE_COUNTED_SCOPE(__func__);
+
+  PRINT_BIT_EXPR(ForSome(FirstBitsAreZero(63)));
+  PRINT_BIT_EXPR(ForSome(FirstBitsAreZero(64)));
+  PRINT_BIT_EXPR(ForSome(FirstBitsAreZero(65)));
+  PRINT_BIT_EXPR(ForSome(FirstBitsAreZero(128)));
+  PRINT_BIT_EXPR(ForSome(FirstBitsAreZero(129)));
+  PRINT_BIT_EXPR(ForEvery(FirstBitsAreZero(128)));
+
+  PRINT_BIT_EXPR(ForSome(FirstOneIsBit(64)));
+  PRINT_BIT_EXPR(ForSome(FirstOneIsBit(128)));
+
+  PRINT_BIT_EXPR(Equal<Bit>(FirstBitsAreZero(128), FirstBitsAreZero(128)));
+  PRINT_BIT_EXPR(Equal<Bit>(FirstBitsAreZero(128), FirstBitsAreZero(129)));
+}
+
+// Runs `fn` and writes the stats of the searches it made as a line of JSON.
+template <typename FnTy> void PrintSearchStats(const char *label, FnTy fn) {
+  SearchStats stats;
+  {
+    CollectSearchStats collect(&stats);
+    fn();
   }
+  WriteSearchStatsJson(stdout, label, stats);
+}
 
-private:
-  const std::vector<bool> &values_;
-  const SetOfNaturals &indices_present_;
-  SetOfNaturals *unfulfilled_indices_;
-};
-
-template <typename PredicateTy> Bit ForSome(PredicateTy predicate) {
-  ASSERT_ONLY_ONE_ACTIVE_CALL();
-
-  std::vector<bool> scratch;
-  SetOfNaturals indices_of_bits_present;
-  SetOfNaturals indices_of_bits_requested;
-  while (true) {
-    bool current_modulus_too_small = false;
-    LOG("Entering inner loop with indices_of_bits_present.size() = %lld",
-        indices_of_bits_present.size());
-    std::vector<int> indices_of_bits_present_vect;
-    indices_of_bits_present.ForEach(
-        [&](Natural n) { indices_of_bits_present_vect.push_back(n); });
-    scratch.assign(scratch.size(), false);
-    for (uint64_t i = 0, e = 1ull << (1 + indices_of_bits_present.size());
-         i < e; i++) {
-      for (int idx : indices_of_bits_present_vect) {
-        if (!scratch[idx]) {
-          scratch[idx] = true;
-          break;
-        } else {
-          scratch[idx] = false;
-        }
-      }
+void TestSearchStats() {
+  PROFILE_COUNTED_SCOPE(__func__);
 
-#ifdef ENABLE_LOG
-      bool enable_verbose_log = false;
-      if (enable_verbose_log) {
-        std::string scratch_str;
-        for (bool b : scratch) {
-          scratch_str += b ? "1 " : "0 ";
-          ;
-        }
-        LOG("Scratch = %s", scratch_str.c_str());
-      }
-#endif
+  PrintSearchStats("all", [] {
+    PrintSearchStats("Equal<Bit>(FuncF, FuncG)",
+                     [] { Equal<Bit>(FuncF, FuncG); });
+    PrintSearchStats("Modulus<Bit>(FuncF)", [] { Modulus<Bit>(FuncF); });
+    PrintSearchStats("ForSome(FirstOneIsBit(128))",
+                     [] { ForSome(FirstOneIsBit(128)); });
+  });
 
-      LazyBitSequence lazy_bit_stream(&scratch, &indices_of_bits_present,
-                                      &indices_of_bits_requested);
+  // Labels are escaped.
+  WriteSearchStatsJson(stdout, "Find(\"x\\y\")", SearchStats());
+}
 
-      std::optional<Bit> result = predicate(&lazy_bit_stream);
-      if (result.has_value() && *result) {
-        return true;
-      }
+SearchBudget MaxEvaluations(int64_t max_evaluations) {
+  SearchBudget budget;
+  budget.max_evaluations = max_evaluations;
+  return budget;
+}
 
-      if (!result.has_value()) {
-        // This is where we need the condition asserted by OnlyOneActiveForSome.
-        //
-        // We assume that if `predicate` has returned the sentinel value then it
-        // must have run out of bits.  But that is not necessary if we allowed
-        // nested ForSome calls -- it could have run out of bits in the
-        // LazyBitSequence provided by an "outer" ForSome.
-        Natural new_scratch_size = scratch.size();
-        indices_of_bits_requested.ForEach([&](Natural requested_index) {
-          LOG("New index requested: %llu", requested_index);
-          indices_of_bits_present.Insert(requested_index);
-          new_scratch_size = std::max(new_scratch_size, requested_index + 1);
-        });
-        scratch.resize(new_scratch_size);
-        current_modulus_too_small = true;
-        indices_of_bits_requested.Clear();
-        break;
-      }
-    }
+SearchBudget MaxWallTime(std::chrono::nanoseconds max_wall_time) {
+  SearchBudget budget;
+  budget.max_wall_time = max_wall_time;
+  return budget;
+}
 
-    if (!current_modulus_too_small) {
-#ifdef ENABLE_LOG
-      std::string indices_of_bits_present_str;
-      indices_of_bits_present.ForEach([&](Natural idx) {
-        indices_of_bits_present_str += std::to_string(idx);
-        indices_of_bits_present_str += " ";
-      });
-      LOG("Tried all possibilities with %s",
-          indices_of_bits_present_str.c_str());
-#endif
-      return false;
+SearchBudget Cancelled() {
+  static CancellationToken token;
+  token.Cancel();
+  SearchBudget budget;
+  budget.cancellation = &token;
+  return budget;
+}
+
+// Whether `f_a` and `f_b` differ on the sequence in `cylinder` with all other
+// bits zero.
+template <typename PredicateTy>
+Bit DifferOn(const Cylinder &cylinder, PredicateTy f_a, PredicateTy f_b) {
+  CylinderBitSequence sequence(&cylinder);
+  return f_a(&sequence) != f_b(&sequence);
+}
+
+void TestWitnesses() {
+  PROFILE_COUNTED_SCOPE(__func__);
+
+  printf("Find(FuncF) = ");
+  Find(FuncF)->Print(stdout);
+  PRINT_BIT_EXPR(Find(FirstBitsAreZero(3)).has_value());
+  printf("Find(FirstOneIsBit(6)) = ");
+  Find(FirstOneIsBit(6))->Print(stdout);
+  // Found by the tree search.
+  PRINT_NAT_EXPR(Find(FirstOneIsBit(70))->bits.size());
+  PRINT_BIT_EXPR(Find(Negation(FirstBitsAreZero(0))).has_value());
+
+  PRINT_BIT_EXPR(FindDisagreement<Bit>(FuncF, FuncF).has_value());
+  std::optional<Cylinder> disagreement = FindDisagreement<Bit>(FuncF, FuncG);
+  printf("FindDisagreement<Bit>(FuncF, FuncG) = ");
+  disagreement->Print(stdout);
+  PRINT_BIT_EXPR(DifferOn(*disagreement, FuncF, FuncG));
+}
+
+void TestBudgets() {
+  PROFILE_COUNTED_SCOPE(__func__);
+
+  PRINT_TRUTH_EXPR(ForSome(FuncF, MaxEvaluations(100)).truth);
+  PRINT_TRUTH_EXPR(ForEvery(FuncF, MaxEvaluations(100)).truth);
+  PRINT_TRUTH_EXPR(Equal<Bit>(FuncF, FuncG, MaxEvaluations(100)).truth);
+  PRINT_TRUTH_EXPR(Equal<Bit>(FuncF, FuncF, MaxEvaluations(5)).truth);
+  PRINT_NAT_EXPR(
+      Equal<Bit>(FuncF, FuncF, MaxEvaluations(5)).stats.predicate_invocations);
+  PRINT_TRUTH_EXPR(ForSome(FirstOneIsBit(128), MaxEvaluations(100)).truth);
+
+  PRINT_NAT_EXPR(*Modulus<Bit>(FuncF, SearchBudget()).value);
+  PRINT_BIT_EXPR(Modulus<Bit>(FuncG, MaxEvaluations(1000)).value.has_value());
+  PRINT_NAT_EXPR(
+      Modulus<Bit>(FuncG, MaxEvaluations(1000)).stats.predicate_invocations);
+  SearchBudget ten_ms = MaxWallTime(std::chrono::milliseconds(10));
+  PRINT_BIT_EXPR(Modulus<Bit>(FuncG, ten_ms).value.has_value());
+  PRINT_TRUTH_EXPR(ForSome(FuncF, Cancelled()).truth);
+}
+
+void TestAsync() {
+  PROFILE_COUNTED_SCOPE(__func__);
+
+  // All of TestA at once.
+  std::vector<SearchFuture<BoundedTruth>> equal;
+  equal.push_back(EqualAsync<Bit>(FuncF, FuncF));
+  equal.push_back(EqualAsync<Bit>(FuncG, FuncG));
+  equal.push_back(EqualAsync<Bit>(FuncF, FuncG));
+  equal.push_back(EqualAsync<Bit>(FuncG, FuncF));
+  SearchFuture<BoundedNatural> modulus_f = ModulusAsync<Bit>(FuncF);
+  SearchFuture<BoundedNatural> modulus_g = ModulusAsync<Bit>(FuncG);
+  for (SearchFuture<BoundedTruth> &future : equal) {
+    PRINT_TRUTH_EXPR(future.Get().truth);
+  }
+  PRINT_NAT_EXPR(*modulus_f.Get().value);
+  PRINT_NAT_EXPR(*modulus_g.Get().value);
+
+  // Takes seconds unless cancelled.
+  SearchFuture<BoundedNatural> cancelled = ModulusAsync<Bit>(FuncG);
+  cancelled.Cancel();
+  PRINT_BIT_EXPR(cancelled.Get().value.has_value());
+
+  // Cancelling the parent token cancels the search too.
+  CancellationToken parent;
+  SearchBudget budget;
+  budget.cancellation = &parent;
+  SearchFuture<BoundedTruth> child =
+      EqualAsync<Bit>(FirstBitsAreZero(40), FirstBitsAreZero(40), budget);
+  parent.Cancel();
+  PRINT_TRUTH_EXPR(child.Get().truth);
+}
+
+void TestBatch() {
+  PROFILE_COUNTED_SCOPE(__func__);
+
+  // TestA again, plus a search.
+  std::vector<Check> checks = {
+      MakeEqualCheck<Bit>("Equal<Bit>(FuncF, FuncF)", FuncF, FuncF),
+      MakeEqualCheck<Bit>("Equal<Bit>(FuncG, FuncG)", FuncG, FuncG),
+      MakeEqualCheck<Bit>("Equal<Bit>(FuncF, FuncG)", FuncF, FuncG),
+      MakeEqualCheck<Bit>("Equal<Bit>(FuncG, FuncF)", FuncG, FuncF),
+      MakeModulusCheck<Bit>("Modulus<Bit>(FuncF)", FuncF),
+      MakeModulusCheck<Bit>("Modulus<Bit>(FuncG)", FuncG),
+      MakeForSomeCheck("ForSome(FirstOneIsBit(20))", FirstOneIsBit(20)),
+  };
+  CheckHistory history;
+  BatchOptions options;
+  options.history = &history;
+  BatchReport report = RunBatch(checks, options);
+  for (const CheckResult &result : report.results) {
+    if (result.value) {
+      PRINT_NAT_EXPR(*result.value);
+    } else {
+      PRINT_TRUTH_EXPR(result.truth);
     }
   }
+
+  // Without history the Modulus checks have no estimate, so they go first.
+  PRINT_NAT_EXPR(report.start_order[0]);
+  PRINT_NAT_EXPR(report.start_order[1]);
+
+  // With it, the slowest check goes first.  The Modulus checks are left out
+  // of this batch to save time.
+  checks.erase(checks.begin() + 4, checks.begin() + 6);
+  report = RunBatch(checks, options);
+  PRINT_NAT_EXPR(report.start_order[0]);
+  PrintBatchReport(stdout, checks, report);
+
+  // A check that runs a batch of its own on the same single thread, which
+  // only finishes if waiting threads run queued checks themselves.
+  Executor executor(1);
+  BatchOptions nested_options;
+  nested_options.executor = &executor;
+  Check nested_batch;
+  nested_batch.name = "RunBatch(inner)";
+  nested_batch.run = [&](const SearchBudget &) {
+    std::vector<Check> inner = {
+        MakeForSomeCheck("ForSome(FirstOneIsBit(4))", FirstOneIsBit(4))};
+    return RunBatch(inner, nested_options).results[0];
+  };
+  nested_batch.estimate_evaluations = [] { return -1.0; };
+  report = RunBatch({nested_batch}, nested_options);
+  PRINT_TRUTH_EXPR(report.results[0].truth);
+}
+
+// Random predicates of various shapes, each run through every ForSome engine.
+RandomPredicateOptions Shallow() {
+  RandomPredicateOptions options;
+  options.max_depth = 4;
+  options.index_range = 8;
+  return options;
+}
+
+RandomPredicateOptions DeepAndAdaptive() {
+  RandomPredicateOptions options;
+  options.max_depth = 10;
+  options.adaptivity = 1;
+  // With hundreds of leaves a higher bias makes almost every tree satisfiable.
+  options.true_bias = 0.01;
+  return options;
+}
+
+RandomPredicateOptions FixedReadOrder() {
+  RandomPredicateOptions options;
+  options.max_depth = 12;
+  options.adaptivity = 0;
+  options.leaf_probability = 0.1;
+  return options;
+}
+
+RandomPredicateOptions RarelyTrue() {
+  RandomPredicateOptions options;
+  options.max_depth = 8;
+  options.true_bias = 0.05;
+  return options;
+}
+
+void TestRandomPredicates() {
+  PROFILE_COUNTED_SCOPE(__func__);
+
+  PRINT_BIT_EXPR(EnginesAgreeOnRandomPredicates(Shallow(), 1, 100));
+  PRINT_BIT_EXPR(EnginesAgreeOnRandomPredicates(DeepAndAdaptive(), 1, 100));
+  PRINT_BIT_EXPR(EnginesAgreeOnRandomPredicates(FixedReadOrder(), 1, 100));
+  PRINT_BIT_EXPR(EnginesAgreeOnRandomPredicates(RarelyTrue(), 1, 100));
+}
+
+// The number of nodes in the decision tree of `predicate`, by walking it.
+template <typename PredicateTy> int64_t CountTreeNodes(PredicateTy predicate) {
+  DecisionTreeWalker<Bit, PredicateTy> walker(std::move(predicate));
+  while (walker.Next()) {
+  }
+  return walker.stats().predicate_invocations;
 }
 
-template <typename PredicateTy> Bit ForEvery(PredicateTy pred) {
-  auto inverse_pred = [=](BitSequence *c) -> std::optional<Bit> {
-    ASSIGN_OR_RETURN(Bit, val, pred(c));
-    return !val;
+// Returns true if the 95% interval of a 200 probe estimate contains the
+// actual size of the tree.
+template <typename PredicateTy>
+bool EstimateCoversTreeSize(PredicateTy predicate) {
+  SearchCostEstimate estimate =
+      EstimateSearchCost(predicate, /*probes=*/200, /*seed=*/1);
+  int64_t actual = CountTreeNodes(predicate);
+  return estimate.evaluations_low <= actual &&
+         actual <= estimate.evaluations_high;
+}
+
+// Returns a predicate that is true iff the first `n` bits have odd parity.
+auto ParityOfFirstBits(Natural n) {
+  return [n](BitSequence *a) -> std::optional<Bit> {
+    Bit parity = false;
+    for (Natural i = 0; i < n; i++) {
+      ASSIGN_OR_RETURN(Bit, bit, a->Get(i));
+      parity ^= bit;
+    }
+    return parity;
   };
-  return !ForSome(inverse_pred);
 }
 
-// Can be used to map a single bit sequence into N bit sequences, each reading
-// mapping bit `I` to bit `N*I+J` in the main sequence, with 0 <= `J` < N.
-class StridedBitSequence : public BitSequence {
-public:
-  StridedBitSequence(BitSequence *source, int stride, int offset)
-      : source_(source), stride_(stride), offset_(offset) {}
+// How many of `count` random trees EstimateCoversTreeSize holds for.
+int64_t EstimatesCoveringRandomTrees(int count) {
+  int64_t covered = 0;
+  for (int seed = 1; seed <= count; seed++) {
+    covered += EstimateCoversTreeSize(
+        RandomPredicate::Generate(DeepAndAdaptive(), seed));
+  }
+  return covered;
+}
+
+void TestCostEstimates() {
+  PROFILE_COUNTED_SCOPE(__func__);
+
+  // A probe down either branch of FuncF's root estimates 15 or 7 nodes.
+  PRINT_NAT_EXPR(CountTreeNodes(FuncF));
+  PRINT_BIT_EXPR(EstimateCoversTreeSize(FuncF));
+  PRINT_BIT_EXPR(EstimateCoversTreeSize(FuncG));
+
+  // Every probe of a complete tree makes the exact estimate.
+  PRINT_NAT_EXPR(CountTreeNodes(ParityOfFirstBits(6)));
+  PRINT_NAT_EXPR(EstimateSearchCost(ParityOfFirstBits(6), 10, 1).evaluations);
+
+  // Without probes there is nothing to average.
+  PRINT_BIT_EXPR(EstimateSearchCost(ParityOfFirstBits(6), 0, 1).evaluations ==
+                 0);
 
-  std::optional<Bit> Get(Natural idx) override {
-    return source_->Get(idx * stride_ + offset_);
+  PRINT_NAT_EXPR(EstimatesCoveringRandomTrees(100));
+}
+
+// Prints every cylinder on which `predicate` is true, and how much of Cantor
+// space they cover together.
+template <typename PredicateTy> void PrintAllWitnesses(PredicateTy predicate) {
+  double measure = 0;
+  auto witnesses = AllWitnesses(predicate);
+  while (witnesses.Next()) {
+    printf("  ");
+    witnesses.cylinder().Print(stdout);
+    measure += std::ldexp(1.0, -witnesses.cylinder().bits.size());
   }
+  printf("  measure = %g\n", measure);
+}
 
-private:
-  BitSequence *source_;
-  int stride_;
-  int offset_;
-};
-
-template <typename Predicate2Ty> Bit ForEvery2(Predicate2Ty pred) {
-  return ForEvery([=](BitSequence *product) {
-    StridedBitSequence a(product, /*stride=*/2, /*offset=*/0);
-    StridedBitSequence b(product, /*stride=*/2, /*offset=*/1);
-    return pred(&a, &b);
-  });
+void TestAllWitnesses() {
+  PROFILE_COUNTED_SCOPE(__func__);
+
+  printf("AllWitnesses(FuncF):\n");
+  PrintAllWitnesses(FuncF);
+  printf("AllWitnesses(Negation(AgreeOn<Bit>(FuncF, FuncG))):\n");
+  PrintAllWitnesses(Negation(AgreeOn<Bit>(FuncF, FuncG)));
+  printf("AllWitnesses(FirstBitsAreZero(0)):\n");
+  PrintAllWitnesses(FirstBitsAreZero(0));
+  printf("AllWitnesses(Negation(FirstBitsAreZero(0))):\n");
+  PrintAllWitnesses(Negation(FirstBitsAreZero(0)));
+
+  // Stops after the first of 2^19 cylinders.
+  auto witnesses = AllWitnesses(ParityOfFirstBits(20));
+  PRINT_BIT_EXPR(witnesses.Next());
+  PRINT_NAT_EXPR(witnesses.stats().predicate_invocations);
 }
 
-template <typename T, typename PredicateTy>
-Bit Equal(PredicateTy f_a, PredicateTy f_b) {
-  auto check = [=](BitSequence *idx) -> std::optional<Bit> {
-    ASSIGN_OR_RETURN(T, a, f_a(idx));
-    ASSIGN_OR_RETURN(T, b, f_b(idx));
-    return a == b;
+void TestMeasure() {
+  PROFILE_COUNTED_SCOPE(__func__);
+
+  PRINT_DYADIC_EXPR(Measure(FuncF));
+  PRINT_DYADIC_EXPR(Measure(FuncG));
+  PRINT_DYADIC_EXPR(Measure(FirstBitsAreZero(0)));
+  PRINT_DYADIC_EXPR(Measure(Negation(FirstBitsAreZero(0))));
+  PRINT_DYADIC_EXPR(Measure(ParityOfFirstBits(10)));
+  PRINT_DYADIC_EXPR(Measure(FirstBitsAreZero(100)));
+  PRINT_DYADIC_EXPR(Measure(Negation(FirstBitsAreZero(100))));
+
+  PRINT_DYADIC_EXPR(DisagreementMeasure<Bit>(FuncF, FuncF));
+  PRINT_DYADIC_EXPR(DisagreementMeasure<Bit>(FuncF, FuncG));
+}
+
+// Prints ApproxMeasure of `predicate`, labelled `label`, and returns whether
+// its interval holds `measure`.
+template <typename PredicateTy>
+Bit ApproxMeasureHolds(const char *label, PredicateTy predicate,
+                       Natural index_range, double measure) {
+  ApproxMeasureOptions options;
+  options.index_range = index_range;
+  MeasureEstimate estimate = ApproxMeasure(predicate, options);
+  printf("ApproxMeasure(%s) = %g in [%g, %g]%s\n", label, estimate.measure,
+         estimate.low, estimate.high, estimate.exact ? " (exact)" : "");
+  return estimate.low <= measure && measure <= estimate.high;
+}
+
+void TestApproxMeasure() {
+  PROFILE_COUNTED_SCOPE(__func__);
+
+  PRINT_BIT_EXPR(ApproxMeasureHolds("FuncF", FuncF, 16, 0.625));
+  PRINT_BIT_EXPR(ApproxMeasureHolds("FirstBitsAreZero(40)",
+                                    FirstBitsAreZero(40), 40, 0x1p-40));
+
+  // Measure would walk all 2^25 - 1 nodes of this tree.
+  PRINT_BIT_EXPR(ApproxMeasureHolds("ParityOfFirstBits(24)",
+                                    ParityOfFirstBits(24), 24, 0.5));
+  // Few leaves, but too many solutions for the estimate to be exact.
+  PRINT_BIT_EXPR(ApproxMeasureHolds("Negation(FirstBitsAreZero(3))",
+                                    Negation(FirstBitsAreZero(3)), 40,
+                                    1 - 0.125));
+}
+
+// The number of ones among the first `n` bits, and an upper bound on it for
+// Sup: the ones already fixed plus the bits still free.
+auto OnesInFirstBits(Natural n) {
+  return [n](BitSequence *a) -> std::optional<Natural> {
+    Natural ones = 0;
+    for (Natural i = 0; i < n; i++) {
+      ASSIGN_OR_RETURN(Bit, bit, a->Get(i));
+      ones += bit;
+    }
+    return ones;
   };
-  return ForEvery(check);
 }
 
-template <typename PredicateNoOptionalTy>
-Natural Least(PredicateNoOptionalTy fn) {
-  Natural i = 0;
-  while (!fn(i)) {
-    i++;
+auto MostOnesInFirstBits(Natural n) {
+  return [n](const Cylinder &cylinder) {
+    Natural ones = 0, fixed = 0;
+    for (const auto &[idx, value] : cylinder.bits) {
+      fixed += idx < n;
+      ones += idx < n && value;
+    }
+    return ones + n - fixed;
+  };
+}
+
+// The index of the first one among the first `n` bits, or `n` if there is
+// none: the number of bits a linear scan for a one reads before it stops.
+auto FirstOneIndex(Natural n) {
+  return [n](BitSequence *a) -> std::optional<Natural> {
+    for (Natural i = 0; i < n; i++) {
+      ASSIGN_OR_RETURN(Bit, bit, a->Get(i));
+      if (bit) {
+        return i;
+      }
+    }
+    return n;
+  };
+}
+
+void PrintExtremum(const char *label, const Extremum &extremum) {
+  printf("%s = %llu on ", label,
+         static_cast<unsigned long long>(extremum.value));
+  extremum.cylinder.Print(stdout);
+}
+
+// 2^64 - 1 if the first bit is set and 2^63 otherwise.
+std::optional<Natural> TopBitSet(BitSequence *x) {
+  ASSIGN_OR_RETURN(Bit, x0, x->Get(0));
+  return x0 ? ~Natural(0) : Natural(1) << 63;
+}
+
+void TestIntegrals() {
+  PROFILE_COUNTED_SCOPE(__func__);
+
+  PRINT_DYADIC_EXPR(Integrate<Bit>(FuncF));
+  PRINT_DYADIC_EXPR(Integrate<Natural>(FirstOneIndex(4)));
+  PRINT_DYADIC_EXPR(Integrate<Natural>(OnesInFirstBits(10)));
+  // Values with the top bit set.
+  PRINT_DYADIC_EXPR(DyadicRational::Of(~Natural(0), 70));
+  PRINT_DYADIC_EXPR(Integrate<Natural>(TopBitSet));
+
+  PrintExtremum("Sup(FirstOneIndex(4))", Sup(FirstOneIndex(4)));
+  PrintExtremum("Inf(FirstOneIndex(4))", Inf(FirstOneIndex(4)));
+
+  // The bound lets Sup skip the subtrees that cannot beat the incumbent.
+  SearchStats unbounded, bounded;
+  {
+    CollectSearchStats collect(&unbounded);
+    PrintExtremum("Sup(OnesInFirstBits(8))", Sup(OnesInFirstBits(8)));
+  }
+  {
+    CollectSearchStats collect(&bounded);
+    PrintExtremum(
+        "Sup(OnesInFirstBits(8), MostOnesInFirstBits(8))",
+        Sup(OnesInFirstBits(8), MostOnesInFirstBits(8)));
+  }
+  PRINT_NAT_EXPR(unbounded.predicate_invocations);
+  PRINT_NAT_EXPR(bounded.predicate_invocations);
+}
+
+// True on all of the half of Cantor space where the first bit is zero, and
+// on half of the other half.  Its tree has 2^16 + 1 leaves, but its majority
+// is settled within the first few.
+std::optional<Bit> MostlyTrue(BitSequence *a) {
+  ASSIGN_OR_RETURN(Bit, first, a->Get(0));
+  if (!first) {
+    return true;
   }
-  return i;
+  ShiftedBitSequence rest(a, /*shift=*/1);
+  return ParityOfFirstBits(16)(&rest);
 }
 
-std::optional<bool> Eq(Natural n, BitSequence *a, BitSequence *b) {
+std::optional<Bit> FirstBit(BitSequence *x) { return x->Get(0); }
+
+// The same set as FirstBit, with a decision tree that also branches on the
+// second bit.
+std::optional<Bit> FirstBitAfterSecond(BitSequence *x) {
+  ASSIGN_OR_RETURN(Bit, x0, x->Get(0));
+  ASSIGN_OR_RETURN(Bit, x1, x->Get(1));
+  (void)x1;
+  return x0;
+}
+
+void TestCountingQuantifiers() {
+  PROFILE_COUNTED_SCOPE(__func__);
+
+  PRINT_BIT_EXPR(AtLeastMeasure(FuncF, DyadicRational::Of(1, 1)));
+  PRINT_BIT_EXPR(AtLeastMeasure(FuncF, DyadicRational::Of(5, 3)));
+  PRINT_BIT_EXPR(AtLeastMeasure(FuncF, DyadicRational::Of(3, 2)));
+  PRINT_BIT_EXPR(AtLeastMeasure(FirstBitsAreZero(0), DyadicRational::Of(1, 0)));
+  PRINT_BIT_EXPR(Majority(FuncF));
+  PRINT_BIT_EXPR(Majority(FuncG));
+  PRINT_BIT_EXPR(Majority(ParityOfFirstBits(10)));
+
+  PRINT_BIT_EXPR(ExistsUnique(FirstBitsAreZero(3)));
+  PRINT_BIT_EXPR(ExistsUnique(FuncF));
+  PRINT_BIT_EXPR(ExistsUnique(Negation(FirstBitsAreZero(0))));
+  PRINT_BIT_EXPR(ExistsUnique(FirstBit));
+  PRINT_BIT_EXPR(ExistsUnique(FirstBitAfterSecond));
+  PRINT_BIT_EXPR(ExistsUnique(ParityOfFirstBits(2)));
+
+  SearchStats majority;
+  {
+    CollectSearchStats collect(&majority);
+    PRINT_BIT_EXPR(Majority(MostlyTrue));
+  }
+  PRINT_NAT_EXPR(majority.predicate_invocations);
+}
+
+// The first bit of `x`, in a roundabout way.
+std::optional<Bit> FirstBitAndSomeBit(BitSequence *x) {
+  return ForSome([x](BitSequence *y) -> std::optional<Bit> {
+    ASSIGN_OR_RETURN(Bit, y0, y->Get(0));
+    ASSIGN_OR_RETURN(Bit, x0, x->Get(0));
+    return x0 && y0;
+  });
+}
+
+// Whether `x` and `y` differ on each of their first `n` bits.
+std::optional<Bit> DiffersOnFirstBits(Natural n, BitSequence *x,
+                                      BitSequence *y) {
   for (Natural i = 0; i < n; i++) {
-    ASSIGN_OR_RETURN(Bit, ai, a->Get(i));
-    ASSIGN_OR_RETURN(Bit, bi, b->Get(i));
-    if (ai != bi) {
+    ASSIGN_OR_RETURN(Bit, xi, x->Get(i));
+    ASSIGN_OR_RETURN(Bit, yi, y->Get(i));
+    if (xi == yi) {
       return false;
     }
   }
-
   return true;
 }
 
-template <typename T, typename PredicateTy> Natural Modulus(PredicateTy fn) {
-  auto is_modulus = [=](Natural n) {
-    return ForEvery2([=](BitSequence *a, BitSequence *b) -> std::optional<Bit> {
-      ASSIGN_OR_RETURN(bool, equal, Eq(n, a, b));
-      if (!equal) {
-        return true;
-      }
+// Prints ForEvery of `predicate` and how many searches it took, counting
+// nested ones.
+template <typename PredicateTy>
+void PrintForEveryAndSearches(const char *label, PredicateTy predicate) {
+  SearchStats stats;
+  Bit holds;
+  {
+    CollectSearchStats collect(&stats);
+    holds = ForEvery(predicate);
+  }
+  printf("ForEvery(%s) = %s in %lld searches\n", label,
+         holds ? "true" : "false",
+         static_cast<long long>(stats.searches));
+}
 
-      ASSIGN_OR_RETURN(T, fa, fn(a));
-      ASSIGN_OR_RETURN(T, fb, fn(b));
-      return fa == fb;
+// Quantifiers nested in each other's predicates.
+void TestNestedQuantifiers() {
+  PROFILE_COUNTED_SCOPE(__func__);
+
+  // Every x has a y that differs from it on the first three bits.
+  auto some_y_differs = [](BitSequence *x) -> std::optional<Bit> {
+    return ForSome(
+        [x](BitSequence *y) { return DiffersOnFirstBits(3, x, y); });
+  };
+  PRINT_BIT_EXPR(ForEvery(some_y_differs));
+
+  // No y agrees with every x on the first bit.
+  auto every_x_agrees = [](BitSequence *y) -> std::optional<Bit> {
+    return ForEvery([y](BitSequence *x) -> std::optional<Bit> {
+      ASSIGN_OR_RETURN(Bit, x0, x->Get(0));
+      ASSIGN_OR_RETURN(Bit, y0, y->Get(0));
+      return x0 == y0;
     });
   };
-  return Least(is_modulus);
-}
+  PRINT_BIT_EXPR(ForSome(every_x_agrees));
+
+  // Three levels: for every x there is a y such that every z with its first
+  // bit set has y's first bit equal to x's second.
+  auto three_levels = [](BitSequence *x) -> std::optional<Bit> {
+    return ForSome([x](BitSequence *y) -> std::optional<Bit> {
+      return ForEvery([x, y](BitSequence *z) -> std::optional<Bit> {
+        ASSIGN_OR_RETURN(Bit, z0, z->Get(0));
+        if (!z0) {
+          return true;
+        }
+        ASSIGN_OR_RETURN(Bit, y0, y->Get(0));
+        ASSIGN_OR_RETURN(Bit, x1, x->Get(1));
+        return y0 == x1;
+      });
+    });
+  };
+  PRINT_BIT_EXPR(ForEvery(three_levels));
+
+  // The inner search reads more than 64 bits, so it hands over to the tree
+  // search, nested in the outer enumeration.
+  auto wide_inner = [](BitSequence *x) -> std::optional<Bit> {
+    return ForSome([x](BitSequence *y) -> std::optional<Bit> {
+      ASSIGN_OR_RETURN(Bit, zeros, FirstBitsAreZero(64)(y));
+      ASSIGN_OR_RETURN(Bit, y65, y->Get(65));
+      ASSIGN_OR_RETURN(Bit, x0, x->Get(0));
+      return zeros && y65 == x0;
+    });
+  };
+  PRINT_BIT_EXPR(ForEvery(wide_inner));
 
-std::optional<Bit> FuncF(BitSequence *a) {
-  ASSIGN_OR_RETURN(Bit, t0, a->Get(4));
-  ASSIGN_OR_RETURN(Bit, t1, a->Get(t0 * 7));
-  ASSIGN_OR_RETURN(Bit, t2, a->Get(7));
-  return t0 * 7 + t1 * t2;
-}
+  PRINT_BIT_EXPR(ForEvery(FirstBitAndSomeBit));
 
-std::optional<Bit> FuncG(BitSequence *a) {
-  ASSIGN_OR_RETURN(Bit, t0, a->Get(4));
-  ASSIGN_OR_RETURN(Bit, t1, a->Get(7));
-  ASSIGN_OR_RETURN(Bit, t2, a->Get(t0 + 11 * t1));
-  return t2 * t0;
-}
+  // Sup nested in a predicate: its first evaluations read an outer bit the
+  // outer search has not assigned yet, so it gives up before any leaf.
+  auto sup_reaches_one = [](BitSequence *x) -> std::optional<Bit> {
+    Extremum sup = Sup([x](BitSequence *y) -> std::optional<Natural> {
+      ASSIGN_OR_RETURN(Bit, x0, x->Get(0));
+      ASSIGN_OR_RETURN(Bit, y0, y->Get(0));
+      return x0 + y0;
+    });
+    return sup.value >= 1;
+  };
+  PRINT_BIT_EXPR(ForEvery(sup_reaches_one));
+
+  // The inner search only reads x's first three bits, but the outer one reads
+  // ten, so memoizing it saves all but 8 of its runs.
+  auto wide_outer = [](BitSequence *x) -> std::optional<Bit> {
+    Bit differs = ForSome(
+        [x](BitSequence *y) { return DiffersOnFirstBits(3, x, y); });
+    ASSIGN_OR_RETURN(Bit, zeros, FirstBitsAreZero(10)(x));
+    return differs || zeros;
+  };
+  auto memoized_wide_outer = [](BitSequence *x) -> std::optional<Bit> {
+    auto some_y_differs = [](BitSequence *x) {
+      return ForSome(
+          [x](BitSequence *y) { return DiffersOnFirstBits(3, x, y); });
+    };
+    ASSIGN_OR_RETURN(Bit, differs, Memoized(x, some_y_differs));
+    ASSIGN_OR_RETURN(Bit, zeros, FirstBitsAreZero(10)(x));
+    return differs || zeros;
+  };
+  PrintForEveryAndSearches("wide_outer", wide_outer);
+  PrintForEveryAndSearches("memoized_wide_outer", memoized_wide_outer);
 
-void TestA() {
-  CREATE_TIMER();
+  // Functionals defined by quantifiers, compared and measured.
+  PRINT_BIT_EXPR(Equal<Bit>(FirstBitAndSomeBit, FirstBit));
+  PRINT_DYADIC_EXPR(Measure(FirstBitAndSomeBit));
+  PRINT_NAT_EXPR(Modulus<Bit>(FirstBitAndSomeBit));
+}
 
-  PRINT_BIT_EXPR(Equal<Bit>(FuncF, FuncF));
-  PRINT_BIT_EXPR(Equal<Bit>(FuncG, FuncG));
+int main() {
+  // Set IMPOSSIBLE_TRACE to a file name to record a trace of the run.  Render
+  // it with trace_decode.
+  const char *trace_path = getenv("IMPOSSIBLE_TRACE");
+  Tracer::SetEnabled(trace_path != nullptr);
+
+  // Set IMPOSSIBLE_PROFILE to "off" to turn off the profile printed at exit,
+  // or to "detailed" to include every predicate evaluation in it.
+  const char *profile_mode = getenv("IMPOSSIBLE_PROFILE");
+  if (profile_mode && strcmp(profile_mode, "off") == 0) {
+    Profiler::SetMode(ProfileMode::kOff);
+  } else if (profile_mode && strcmp(profile_mode, "detailed") == 0) {
+    Profiler::SetMode(ProfileMode::kDetailed);
+  } else {
+    Profiler::SetMode(ProfileMode::kCoarse);
+  }
 
-  PRINT_BIT_EXPR(Equal<Bit>(FuncF, FuncG));
-  PRINT_BIT_EXPR(Equal<Bit>(FuncG, FuncF));
+  TestA();
+  TestViews();
+  TestLargeIndexSets();
+  TestSearchStats();
+  TestRandomPredicates();
+  TestCostEstimates();
+  TestWitnesses();
+  TestAllWitnesses();
+  TestMeasure();
+  TestApproxMeasure();
+  TestIntegrals();
+  TestCountingQuantifiers();
+  TestNestedQuantifiers();
+  TestBudgets();
+  TestAsync();
+  TestBatch();
+
+  if (trace_path) {
+    FILE *trace_file = fopen(trace_path, "wb");
+    if (!trace_file || !WriteTrace(trace_file)) {
+      printf("Could not write trace to %s\n", trace_path);
+      return 1;
+    }
+    fclose(trace_file);
+  }
 
-  PRINT_NAT_EXPR(Modulus<Bit>(FuncF));
-  PRINT_NAT_EXPR(Modulus<Bit>(FuncG));
+  Profiler::Report(stdout);
 }
-
-int main() { TestA(); }
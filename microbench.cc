@@ -0,0 +1,219 @@
+// Microbenchmarks for the primitives the search engines are built from, so
+// that a regression in one of them shows up here before it shows up as a
+// slower Modulus.
+//
+// Usage: microbench [--warmup=N] [--repetitions=N] [--min_time_ms=N]
+//                   [--filter=SUBSTRING] [--json=PATH] [--baseline=PATH]
+//                   [--significance_level=P]
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "impossible.h"
+#include "profiler.h"
+#include "utils.h"
+
+// The sequence of all zeros.
+class ZeroBitSequence : public BitSequence {
+public:
+  std::optional<Bit> Get(Natural) override { return false; }
+};
+
+// The state a LazyBitSequence reads from, with bits [0, `size`) present.
+struct LazyBitSequenceFixture {
+  explicit LazyBitSequenceFixture(Natural size) : values(size) {
+    for (Natural i = 0; i < size; i++) {
+      present.Insert(i);
+    }
+  }
+
+  std::vector<Bit> values;
+  SetOfNaturals present;
+  SetOfNaturals unfulfilled;
+  std::vector<uint64_t> last_read;
+  LazyBitSequence sequence{&values, &present, &unfulfilled, &last_read};
+};
+
+std::string Name(const char *primitive, Natural param) {
+  return std::string(primitive) + "/" + std::to_string(param);
+}
+
+void RunSetOfNaturals(BenchmarkRunner *runner) {
+  for (Natural size : {64, 4096, 262144}) {
+    // Inserts every third index up to `size`, starting from an empty set
+    // whose capacity is already there.
+    SetOfNaturals set;
+    runner->Run(
+        Name("SetOfNaturals::Insert", size),
+        [&](int64_t iterations) {
+          for (int64_t i = 0; i < iterations; i++) {
+            set.Clear();
+            for (Natural idx = 0; idx < size; idx += 3) {
+              set.Insert(idx);
+            }
+            DoNotOptimize(set.size());
+          }
+        },
+        (size + 2) / 3);
+
+    runner->Run(
+        Name("SetOfNaturals::Contains", size),
+        [&](int64_t iterations) {
+          for (int64_t i = 0; i < iterations; i++) {
+            int64_t found = 0;
+            for (Natural idx = 0; idx < size; idx++) {
+              found += set.Contains(idx);
+            }
+            DoNotOptimize(found);
+          }
+        },
+        size);
+
+    // One operation per index scanned, not per element visited.
+    runner->Run(
+        Name("SetOfNaturals::ForEach", size),
+        [&](int64_t iterations) {
+          for (int64_t i = 0; i < iterations; i++) {
+            Natural sum = 0;
+            set.ForEach([&](Natural idx) { sum += idx; });
+            DoNotOptimize(sum);
+          }
+        },
+        size);
+  }
+}
+
+void RunLazyBitSequenceGet(BenchmarkRunner *runner) {
+  constexpr Natural kSize = 1024;
+  LazyBitSequenceFixture fixture(kSize);
+  BitSequence *sequence = OpaquePointer<BitSequence>(&fixture.sequence);
+  runner->Run(
+      "LazyBitSequence::Get/hit",
+      [&](int64_t iterations) {
+        for (int64_t i = 0; i < iterations; i++) {
+          fixture.sequence.BeginEvaluation();
+          for (Natural idx = 0; idx < kSize; idx++) {
+            DoNotOptimize(sequence->Get(idx));
+          }
+        }
+      },
+      kSize);
+
+  runner->Run(
+      "LazyBitSequence::Get/miss",
+      [&](int64_t iterations) {
+        for (int64_t i = 0; i < iterations; i++) {
+          fixture.unfulfilled.Clear();
+          for (Natural idx = kSize; idx < 2 * kSize; idx++) {
+            DoNotOptimize(sequence->Get(idx));
+          }
+        }
+      },
+      kSize);
+}
+
+// A Get through `depth` stacked StridedBitSequences over a LazyBitSequence.
+// The views fold, so this should not depend on `depth`.
+void RunStridedChains(BenchmarkRunner *runner) {
+  constexpr Natural kReads = 256;
+  LazyBitSequenceFixture fixture(kReads << 4);
+  for (int depth = 1; depth <= 4; depth++) {
+    std::vector<std::unique_ptr<StridedBitSequence>> chain;
+    BitSequence *top = OpaquePointer<BitSequence>(&fixture.sequence);
+    for (int i = 0; i < depth; i++) {
+      chain.push_back(std::make_unique<StridedBitSequence>(
+          top, /*stride=*/2, /*offset=*/i % 2));
+      top = chain.back().get();
+    }
+
+    runner->Run(
+        Name("StridedBitSequence::Get/depth", depth),
+        [&](int64_t iterations) {
+          for (int64_t i = 0; i < iterations; i++) {
+            fixture.sequence.BeginEvaluation();
+            for (Natural idx = 0; idx < kReads; idx++) {
+              DoNotOptimize(top->Get(idx));
+            }
+          }
+        },
+        kReads);
+  }
+}
+
+// ForSome's enumeration loop on a predicate that reads nothing, so every
+// step after the first is a counter increment, a flip and a footprint check.
+void RunEnumerationLoop(BenchmarkRunner *runner) {
+  constexpr int kSlots = 12;
+  auto reads_nothing = [](BitSequence *) -> std::optional<Bit> {
+    return false;
+  };
+  SearchStats stats;
+  SetOfNaturals unfulfilled;
+  runner->Run(
+      "ForSome::enumerate/prefix",
+      [&](int64_t iterations) {
+        for (int64_t i = 0; i < iterations; i++) {
+          PrefixBitSequence sequence(kSlots, &unfulfilled);
+          DoNotOptimize(EnumerateAssignments(
+              &sequence, kSlots, [](int slot) { return slot; },
+              reads_nothing, &stats, /*meter=*/nullptr));
+        }
+      },
+      1 << kSlots);
+
+  // The same over a LazyBitSequence whose present bits are spread out, which
+  // is what ForSome falls back to when they are not a prefix.
+  LazyBitSequenceFixture fixture(4 * kSlots);
+  std::vector<Natural> slot_indices;
+  for (int slot = 0; slot < kSlots; slot++) {
+    slot_indices.push_back(4 * slot);
+  }
+  runner->Run(
+      "ForSome::enumerate/lazy",
+      [&](int64_t iterations) {
+        for (int64_t i = 0; i < iterations; i++) {
+          DoNotOptimize(EnumerateAssignments(
+              &fixture.sequence, kSlots,
+              [&](int slot) { return slot_indices[slot]; }, reads_nothing,
+              &stats, /*meter=*/nullptr));
+        }
+      },
+      1 << kSlots);
+}
+
+void RunEq(BenchmarkRunner *runner) {
+  ZeroBitSequence zeros_a, zeros_b;
+  BitSequence *a = OpaquePointer<BitSequence>(&zeros_a);
+  BitSequence *b = OpaquePointer<BitSequence>(&zeros_b);
+  for (Natural n : {1, 8, 64, 512}) {
+    runner->Run(Name("Eq", n), [&](int64_t iterations) {
+      for (int64_t i = 0; i < iterations; i++) {
+        DoNotOptimize(Eq(n, a, b));
+      }
+    });
+  }
+}
+
+int main(int argc, char **argv) {
+  BenchmarkOptions options;
+  if (!ParseBenchmarkOptions(argc, argv, &options)) {
+    return 1;
+  }
+  Profiler::SetMode(ProfileMode::kOff);
+  BenchmarkRunner runner(options);
+
+  RunSetOfNaturals(&runner);
+  RunLazyBitSequenceGet(&runner);
+  RunStridedChains(&runner);
+  RunEnumerationLoop(&runner);
+  RunEq(&runner);
+
+  if (!runner.Finish()) {
+    return 1;
+  }
+}
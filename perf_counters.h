@@ -0,0 +1,161 @@
+#ifndef IMPOSSIBLE_PROGRAMS_PERF_COUNTERS_H
+#define IMPOSSIBLE_PROGRAMS_PERF_COUNTERS_H
+
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Per-thread hardware performance counters, read through perf_event_open.
+//
+// Each counter is opened on its own rather than as a group, so that a machine
+// (or VM, or container) that lacks some of them still reports the rest.
+// Counters that could not be opened are reported as unavailable; on systems
+// without perf_event_open all of them are.
+
+enum PerfCounterKind {
+  kPerfCycles,
+  kPerfInstructions,
+  kPerfBranchMisses,
+  kPerfL1DReadMisses,
+  kPerfLLCMisses,
+  kPerfCounterKinds,
+};
+
+struct PerfCounterSample {
+  std::array<uint64_t, kPerfCounterKinds> values{};
+  std::array<bool, kPerfCounterKinds> available{};
+
+  // Returns `this - start` for the counters available in both.
+  PerfCounterSample Since(const PerfCounterSample &start) const {
+    PerfCounterSample delta;
+    for (int i = 0; i < kPerfCounterKinds; i++) {
+      delta.available[i] = available[i] && start.available[i];
+      delta.values[i] = delta.available[i] ? values[i] - start.values[i] : 0;
+    }
+    return delta;
+  }
+};
+
+class PerfCounters {
+public:
+  // The counters of the calling thread, opened the first time this is called
+  // on the thread.
+  static PerfCounters *ForCurrentThread() {
+    static thread_local PerfCounters counters;
+    return &counters;
+  }
+
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters &operator=(const PerfCounters &) = delete;
+
+  ~PerfCounters() {
+#ifdef __linux__
+    for (int fd : fds_) {
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+#endif
+  }
+
+  bool AnyAvailable() const {
+    for (int fd : fds_) {
+      if (fd >= 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Why the first counter that could not be opened failed, or null if all of
+  // them were opened.
+  const char *unavailable_reason() const {
+    return unavailable_reason_.empty() ? nullptr : unavailable_reason_.c_str();
+  }
+
+  // The unavailable_reason() of the first thread that opened its counters
+  // and could not open them all, or empty if there was none.  Unlike
+  // ForCurrentThread this never opens any counters.
+  static std::string FirstUnavailableReason() {
+    std::lock_guard<std::mutex> lock(first_unavailable_reason_mutex_);
+    return first_unavailable_reason_;
+  }
+
+  // Reads all available counters, scaled up for the time they were not
+  // scheduled if the kernel had to multiplex them.
+  PerfCounterSample Read() const {
+    PerfCounterSample sample;
+#ifdef __linux__
+    for (int i = 0; i < kPerfCounterKinds; i++) {
+      // value, time enabled, time running.
+      uint64_t data[3];
+      if (fds_[i] < 0 || read(fds_[i], data, sizeof(data)) != sizeof(data)) {
+        continue;
+      }
+      sample.available[i] = true;
+      sample.values[i] =
+          data[2] == 0 || data[1] == data[2]
+              ? data[0]
+              : static_cast<uint64_t>(static_cast<double>(data[0]) * data[1] /
+                                      data[2]);
+    }
+#endif
+    return sample;
+  }
+
+private:
+  PerfCounters() {
+    fds_.fill(-1);
+#ifdef __linux__
+    Open(kPerfCycles, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    Open(kPerfInstructions, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    Open(kPerfBranchMisses, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    Open(kPerfL1DReadMisses, PERF_TYPE_HW_CACHE,
+         PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+             (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    Open(kPerfLLCMisses, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+#else
+    unavailable_reason_ = "perf_event_open is Linux only";
+#endif
+    std::lock_guard<std::mutex> lock(first_unavailable_reason_mutex_);
+    if (first_unavailable_reason_.empty()) {
+      first_unavailable_reason_ = unavailable_reason_;
+    }
+  }
+
+#ifdef __linux__
+  void Open(PerfCounterKind kind, uint32_t type, uint64_t config) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    fds_[kind] = syscall(SYS_perf_event_open, &attr, /*pid=*/0, /*cpu=*/-1,
+                         /*group_fd=*/-1, /*flags=*/0);
+    if (fds_[kind] < 0 && unavailable_reason_.empty()) {
+      unavailable_reason_ = strerror(errno);
+    }
+  }
+#endif
+
+  std::array<int, kPerfCounterKinds> fds_;
+  std::string unavailable_reason_;
+
+  static inline std::mutex first_unavailable_reason_mutex_;
+  static inline std::string first_unavailable_reason_;
+};
+
+#endif
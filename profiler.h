@@ -0,0 +1,352 @@
+#ifndef IMPOSSIBLE_PROGRAMS_PROFILER_H
+#define IMPOSSIBLE_PROGRAMS_PROFILER_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "perf_counters.h"
+
+// A hierarchical scope profiler.
+//
+// PROFILE_SCOPE(name) times the enclosing block and files it under the scope
+// that was active when the block was entered, so nested scopes build a tree
+// per thread (TestA -> Equal -> ForSome -> predicate).  Every node keeps call
+// counts and a latency histogram from which Profiler::Report prints min, mean,
+// p99 and max.
+//
+// Scopes only record when the profiler mode is at least as detailed as the
+// scope: PROFILE_SCOPE needs kCoarse and PROFILE_DETAILED_SCOPE, meant for
+// very hot scopes like single predicate evaluations, needs kDetailed.  A scope
+// that does not record costs a relaxed load and a branch.
+//
+// PROFILE_COUNTED_SCOPE is a coarse scope that also reads the hardware
+// performance counters on entry and exit, and the report shows IPC and misses
+// per thousand instructions for it.  Reading the counters costs a few system
+// calls, so keep these to scopes that run for at least tens of microseconds.
+
+enum class ProfileMode { kOff, kCoarse, kDetailed };
+
+class ProfileNode {
+public:
+  ProfileNode(const char *name, ProfileNode *parent)
+      : name_(name), parent_(parent) {}
+
+  // Returns the child scope called `name`, creating it if needed.
+  ProfileNode *Child(const char *name) {
+    for (const std::unique_ptr<ProfileNode> &child : children_) {
+      if (child->name_ == name || strcmp(child->name_, name) == 0) {
+        return child.get();
+      }
+    }
+    children_.push_back(std::make_unique<ProfileNode>(name, this));
+    return children_.back().get();
+  }
+
+  void Record(uint64_t ns) {
+    count_++;
+    total_ns_ += ns;
+    min_ns_ = std::min(min_ns_, ns);
+    max_ns_ = std::max(max_ns_, ns);
+    histogram_[BucketFor(ns)]++;
+  }
+
+  void RecordCounters(const PerfCounterSample &delta) {
+    for (int i = 0; i < kPerfCounterKinds; i++) {
+      if (delta.available[i]) {
+        counters_.available[i] = true;
+        counters_.values[i] += delta.values[i];
+      }
+    }
+  }
+
+  // An upper bound on the nearest-rank `fraction` quantile of the recorded
+  // times, exact to within 1/kSubBuckets of its value.
+  uint64_t Quantile(double fraction) const {
+    if (count_ == 0) {
+      return 0;
+    }
+    uint64_t rank = std::max<uint64_t>(std::ceil(fraction * count_), 1);
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < kBuckets; bucket++) {
+      seen += histogram_[bucket];
+      if (seen >= rank) {
+        return std::min(BucketUpperBound(bucket), max_ns_);
+      }
+    }
+    return max_ns_;
+  }
+
+  const char *name() const { return name_; }
+  ProfileNode *parent() const { return parent_; }
+  const std::vector<std::unique_ptr<ProfileNode>> &children() const {
+    return children_;
+  }
+  uint64_t count() const { return count_; }
+  uint64_t total_ns() const { return total_ns_; }
+  uint64_t min_ns() const { return min_ns_; }
+  uint64_t max_ns() const { return max_ns_; }
+  const PerfCounterSample &counters() const { return counters_; }
+
+private:
+  // Log-linear buckets: kSubBuckets per power of two.
+  static constexpr int kSubBucketBits = 3;
+  static constexpr int kSubBuckets = 1 << kSubBucketBits;
+  static constexpr int kBuckets = 64 * kSubBuckets;
+
+  static int BucketFor(uint64_t ns) {
+    if (ns < kSubBuckets) {
+      return ns;
+    }
+    int log2 = 63 - __builtin_clzll(ns);
+    int sub_bucket = (ns >> (log2 - kSubBucketBits)) & (kSubBuckets - 1);
+    return (log2 - kSubBucketBits + 1) * kSubBuckets + sub_bucket;
+  }
+
+  static uint64_t BucketUpperBound(int bucket) {
+    if (bucket < kSubBuckets) {
+      return bucket;
+    }
+    int log2 = bucket / kSubBuckets + kSubBucketBits - 1;
+    uint64_t sub_bucket = bucket % kSubBuckets;
+    uint64_t width = 1ull << (log2 - kSubBucketBits);
+    return (1ull << log2) + (sub_bucket + 1) * width - 1;
+  }
+
+  const char *name_;
+  ProfileNode *parent_;
+  std::vector<std::unique_ptr<ProfileNode>> children_;
+  uint64_t count_ = 0;
+  uint64_t total_ns_ = 0;
+  uint64_t min_ns_ = UINT64_MAX;
+  uint64_t max_ns_ = 0;
+  std::array<uint64_t, kBuckets> histogram_{};
+  PerfCounterSample counters_;
+};
+
+class Profiler {
+  struct ThreadProfile;
+
+public:
+  static ProfileMode Mode() {
+    return static_cast<ProfileMode>(mode_.load(std::memory_order_relaxed));
+  }
+
+  static void SetMode(ProfileMode mode) {
+    mode_.store(static_cast<int>(mode), std::memory_order_relaxed);
+  }
+
+  // While alive, scopes entered on this thread are filed under its root
+  // rather than under the live scopes.
+  class Detached {
+  public:
+    Detached() {
+      if (Mode() != ProfileMode::kOff) {
+        profile_ = CurrentThreadProfile();
+        saved_ = profile_->current;
+        profile_->current = &profile_->root;
+      }
+    }
+    ~Detached() {
+      if (profile_) {
+        profile_->current = saved_;
+      }
+    }
+
+    Detached(const Detached &) = delete;
+    Detached &operator=(const Detached &) = delete;
+
+  private:
+    ThreadProfile *profile_ = nullptr;
+    ProfileNode *saved_ = nullptr;
+  };
+
+  // Makes the child `name` of the current scope current and returns it.
+  static ProfileNode *Enter(const char *name) {
+    ThreadProfile *profile = CurrentThreadProfile();
+    profile->current = profile->current->Child(name);
+    return profile->current;
+  }
+
+  // Records `ns` against `node`, which must be the current scope, and makes
+  // its parent current.
+  static void Exit(ProfileNode *node, uint64_t ns) {
+    node->Record(ns);
+    CurrentThreadProfile()->current = node->parent();
+  }
+
+  // Prints the scope tree of every thread that has recorded a scope.  Call
+  // while no scopes are active, typically just before exiting.
+  static void Report(FILE *out) {
+    // Only PROFILE_COUNTED_SCOPE opens the counters.
+    std::string reason = PerfCounters::FirstUnavailableReason();
+    if (!reason.empty()) {
+      fprintf(out, "Some hardware counters are unavailable: %s\n",
+              reason.c_str());
+    }
+
+    std::lock_guard<std::mutex> lock(registry_mutex_);
+    std::vector<std::unique_ptr<ThreadProfile>> &registry = Registry();
+    for (size_t i = 0; i < registry.size(); i++) {
+      fprintf(out, "Profile of thread %zu:\n", i);
+      fprintf(out, "  %-40s %10s %10s %10s %10s %10s %10s\n", "scope", "calls",
+              "total", "min", "mean", "p99", "max");
+      for (const std::unique_ptr<ProfileNode> &child :
+           registry[i]->root.children()) {
+        ReportNode(out, *child, 0);
+      }
+    }
+  }
+
+private:
+  struct ThreadProfile {
+    ProfileNode root{"<root>", nullptr};
+    ProfileNode *current = &root;
+  };
+
+  static ThreadProfile *CurrentThreadProfile() {
+    static thread_local ThreadProfile *profile = nullptr;
+    if (!profile) {
+      // Owned by the registry so that the report includes exited threads.
+      std::lock_guard<std::mutex> lock(registry_mutex_);
+      Registry().push_back(std::make_unique<ThreadProfile>());
+      profile = Registry().back().get();
+    }
+    return profile;
+  }
+
+  static std::vector<std::unique_ptr<ThreadProfile>> &Registry() {
+    static std::vector<std::unique_ptr<ThreadProfile>> registry;
+    return registry;
+  }
+
+  static void FormatDuration(double ns, char *buffer, size_t size) {
+    std::array<const char *, 4> unit = {"ns", "us", "ms", "s"};
+    int unit_idx = 0;
+    while (unit_idx < 3 && ns >= 1000) {
+      ns /= 1000;
+      unit_idx++;
+    }
+    snprintf(buffer, size, "%.3lf%s", ns, unit[unit_idx]);
+  }
+
+  static void ReportNode(FILE *out, const ProfileNode &node, int depth) {
+    char name[64];
+    snprintf(name, sizeof(name), "%*s%s", 2 * depth, "", node.name());
+
+    char total[16], min[16], mean[16], p99[16], max[16];
+    FormatDuration(node.total_ns(), total, sizeof(total));
+    FormatDuration(node.min_ns(), min, sizeof(min));
+    FormatDuration(node.count() ? static_cast<double>(node.total_ns()) /
+                                      node.count()
+                                : 0,
+                   mean, sizeof(mean));
+    FormatDuration(node.Quantile(0.99), p99, sizeof(p99));
+    FormatDuration(node.max_ns(), max, sizeof(max));
+    fprintf(out, "  %-40s %10llu %10s %10s %10s %10s %10s\n", name,
+            static_cast<unsigned long long>(node.count()), total, min, mean,
+            p99, max);
+
+    ReportCounters(out, node.counters(), depth);
+
+    for (const std::unique_ptr<ProfileNode> &child : node.children()) {
+      ReportNode(out, *child, depth + 1);
+    }
+  }
+
+  static void ReportCounters(FILE *out, const PerfCounterSample &counters,
+                             int depth) {
+    bool any = false;
+    for (bool available : counters.available) {
+      any |= available;
+    }
+    if (!any) {
+      return;
+    }
+
+    char line[160];
+    int length = snprintf(line, sizeof(line), "%*s", 2 * depth + 2, "");
+    auto append_ratio = [&](const char *label, int numerator, int denominator,
+                            double scale) {
+      if (counters.available[numerator] && counters.available[denominator] &&
+          counters.values[denominator] != 0) {
+        length += snprintf(line + length, sizeof(line) - length,
+                           " %s %.3lf", label,
+                           scale * counters.values[numerator] /
+                               counters.values[denominator]);
+      } else {
+        length += snprintf(line + length, sizeof(line) - length, " %s n/a",
+                           label);
+      }
+    };
+    append_ratio("IPC", kPerfInstructions, kPerfCycles, 1);
+    append_ratio("branch-MPKI", kPerfBranchMisses, kPerfInstructions, 1000);
+    append_ratio("L1D-MPKI", kPerfL1DReadMisses, kPerfInstructions, 1000);
+    append_ratio("LLC-MPKI", kPerfLLCMisses, kPerfInstructions, 1000);
+    fprintf(out, "  %s\n", line);
+  }
+
+  static inline std::atomic<int> mode_{static_cast<int>(ProfileMode::kOff)};
+  static inline std::mutex registry_mutex_;
+};
+
+class ProfileScope {
+public:
+  ProfileScope(const char *name, ProfileMode min_mode,
+               bool read_counters = false) {
+    if (Profiler::Mode() >= min_mode) {
+      node_ = Profiler::Enter(name);
+      if (read_counters) {
+        counters_ = PerfCounters::ForCurrentThread();
+        if (counters_->AnyAvailable()) {
+          start_counters_ = counters_->Read();
+        } else {
+          counters_ = nullptr;
+        }
+      }
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+
+  ProfileScope(const ProfileScope &) = delete;
+  ProfileScope &operator=(const ProfileScope &) = delete;
+
+  ~ProfileScope() {
+    if (node_) {
+      uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start_)
+                        .count();
+      if (counters_) {
+        node_->RecordCounters(counters_->Read().Since(start_counters_));
+      }
+      Profiler::Exit(node_, ns);
+    }
+  }
+
+private:
+  ProfileNode *node_ = nullptr;
+  std::chrono::steady_clock::time_point start_;
+  PerfCounters *counters_ = nullptr;
+  PerfCounterSample start_counters_;
+};
+
+#define PROFILE_SCOPE(name)                                                    \
+  ProfileScope __profile_scope(name, ProfileMode::kCoarse)
+
+#define PROFILE_COUNTED_SCOPE(name)                                            \
+  ProfileScope __profile_scope(name, ProfileMode::kCoarse,                     \
+                               /*read_counters=*/true)
+
+#define PROFILE_DETAILED_SCOPE(name)                                           \
+  ProfileScope __profile_scope(name, ProfileMode::kDetailed)
+
+#endif
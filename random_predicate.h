@@ -0,0 +1,252 @@
+#ifndef IMPOSSIBLE_PROGRAMS_RANDOM_PREDICATE_H
+#define IMPOSSIBLE_PROGRAMS_RANDOM_PREDICATE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <optional>
+#include <random>
+#include <vector>
+
+#include "impossible.h"
+#include "utils.h"
+
+// Randomly generated predicates, for scaling benchmarks and for checking the
+// search engines against each other.
+//
+// A RandomPredicate is a decision tree stored as data: every internal node
+// reads one bit and moves to one of two children depending on its value, and
+// every leaf is a result.  Reading the bit at an index chosen by an internal
+// node that is itself reached through earlier bits is what makes predicates
+// like FuncF (`a->Get(t0 * 7)`) adaptive; with `adaptivity` 0 every node at
+// the same depth reads the same index, so the predicate reads a fixed set of
+// bits in a fixed order, stopping early at leaves.
+
+struct RandomPredicateOptions {
+  // Most bits read by a single evaluation.
+  int max_depth = 6;
+
+  // Indices are drawn from [0, index_range).
+  Natural index_range = 16;
+
+  // Probability that a node draws its own index instead of using the index
+  // shared by its depth.
+  double adaptivity = 0.5;
+
+  // Probability that a node below the root is a leaf before `max_depth`.
+  double leaf_probability = 0.2;
+
+  // Probability that a leaf is true.
+  double true_bias = 0.5;
+};
+
+class RandomPredicate {
+public:
+  static RandomPredicate Generate(const RandomPredicateOptions &options,
+                                  uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    std::uniform_int_distribution<Natural> index(0, options.index_range - 1);
+    std::vector<Natural> index_for_depth(options.max_depth);
+    for (Natural &idx : index_for_depth) {
+      idx = index(rng);
+    }
+
+    auto nodes = std::make_shared<std::vector<Node>>();
+    Build(options, index_for_depth, 0, &rng, nodes.get());
+    return RandomPredicate(std::move(nodes));
+  }
+
+  std::optional<Bit> operator()(BitSequence *a) const {
+    const std::vector<Node> &nodes = *nodes_;
+    int32_t node = 0;
+    while (!nodes[node].is_leaf) {
+      ASSIGN_OR_RETURN(Bit, bit, a->Get(nodes[node].index));
+      node = nodes[node].children[bit];
+    }
+    return nodes[node].value;
+  }
+
+  // Whether some sequence satisfies the predicate, worked out from the tree
+  // itself rather than by running a search.  A node that reads an index
+  // already read on its path only has one reachable child.
+  bool Satisfiable() const {
+    std::vector<int8_t> assignment;
+    return Satisfiable(0, &assignment);
+  }
+
+  int64_t node_count() const { return nodes_->size(); }
+
+  // Prints the tree as nested conditionals, e.g. `b3 ? T : (b5 ? F : T)`,
+  // where `bI ? X : Y` is X if bit I is one and Y otherwise.
+  void Print(FILE *out) const {
+    Print(out, 0);
+    fprintf(out, "\n");
+  }
+
+private:
+  struct Node {
+    bool is_leaf;
+    Bit value;
+    Natural index;
+    int32_t children[2];
+  };
+
+  explicit RandomPredicate(std::shared_ptr<const std::vector<Node>> nodes)
+      : nodes_(std::move(nodes)) {}
+
+  static int32_t Build(const RandomPredicateOptions &options,
+                       const std::vector<Natural> &index_for_depth, int depth,
+                       std::mt19937_64 *rng, std::vector<Node> *nodes) {
+    std::uniform_real_distribution<double> coin(0, 1);
+    int32_t id = nodes->size();
+    nodes->push_back({});
+    if (depth == options.max_depth ||
+        (depth > 0 && coin(*rng) < options.leaf_probability)) {
+      (*nodes)[id].is_leaf = true;
+      (*nodes)[id].value = coin(*rng) < options.true_bias;
+      return id;
+    }
+
+    Natural idx = index_for_depth[depth];
+    if (coin(*rng) < options.adaptivity) {
+      idx = std::uniform_int_distribution<Natural>(
+          0, options.index_range - 1)(*rng);
+    }
+    (*nodes)[id].is_leaf = false;
+    (*nodes)[id].index = idx;
+    for (int bit = 0; bit < 2; bit++) {
+      int32_t child = Build(options, index_for_depth, depth + 1, rng, nodes);
+      (*nodes)[id].children[bit] = child;
+    }
+    return id;
+  }
+
+  // `assignment[I]` is -1 if bit I has not been read on the current path and
+  // its value otherwise.
+  bool Satisfiable(int32_t node, std::vector<int8_t> *assignment) const {
+    const Node &current = (*nodes_)[node];
+    if (current.is_leaf) {
+      return current.value;
+    }
+
+    Natural idx = current.index;
+    if (idx >= assignment->size()) {
+      assignment->resize(idx + 1, -1);
+    }
+    if ((*assignment)[idx] >= 0) {
+      return Satisfiable(current.children[(*assignment)[idx]], assignment);
+    }
+    for (int bit = 0; bit < 2; bit++) {
+      (*assignment)[idx] = bit;
+      if (Satisfiable(current.children[bit], assignment)) {
+        (*assignment)[idx] = -1;
+        return true;
+      }
+    }
+    (*assignment)[idx] = -1;
+    return false;
+  }
+
+  void Print(FILE *out, int32_t node) const {
+    const Node &current = (*nodes_)[node];
+    if (current.is_leaf) {
+      fprintf(out, "%s", current.value ? "T" : "F");
+      return;
+    }
+
+    fprintf(out, "b%llu ? ", static_cast<unsigned long long>(current.index));
+    PrintChild(out, current.children[1]);
+    fprintf(out, " : ");
+    PrintChild(out, current.children[0]);
+  }
+
+  void PrintChild(FILE *out, int32_t node) const {
+    bool parenthesize = !(*nodes_)[node].is_leaf;
+    fprintf(out, "%s", parenthesize ? "(" : "");
+    Print(out, node);
+    fprintf(out, "%s", parenthesize ? ")" : "");
+  }
+
+  std::shared_ptr<const std::vector<Node>> nodes_;
+};
+
+// A way of answering ForSome, for the differential checks below.
+struct ForSomeEngine {
+  const char *name;
+  Bit (*for_some)(const RandomPredicate &);
+};
+
+// Every ForSome engine, plus the answer worked out from the tree itself.
+inline const std::vector<ForSomeEngine> &ForSomeEngines() {
+  static const std::vector<ForSomeEngine> engines = {
+      {"Satisfiable",
+       [](const RandomPredicate &predicate) -> Bit {
+         return predicate.Satisfiable();
+       }},
+      {"ForSome",
+       [](const RandomPredicate &predicate) { return ForSome(predicate); }},
+      {"ForSomeTreeSearch",
+       [](const RandomPredicate &predicate) {
+         return ForSomeTreeSearch(predicate);
+       }},
+      {"ForSome(SearchBudget())",
+       [](const RandomPredicate &predicate) -> Bit {
+         return ForSome(predicate, SearchBudget()).truth == Truth::kTrue;
+       }},
+      {"Find",
+       [](const RandomPredicate &predicate) -> Bit {
+         return Find(predicate).has_value();
+       }},
+      {"AllWitnesses",
+       [](const RandomPredicate &predicate) {
+         return AllWitnesses(predicate).Next();
+       }},
+      {"Measure",
+       [](const RandomPredicate &predicate) {
+         return !(Measure(predicate) == DyadicRational());
+       }},
+  };
+  return engines;
+}
+
+// Runs `predicate` through every engine.  Returns true if they all agree;
+// otherwise prints the predicate and each engine's answer to stderr.
+inline bool EnginesAgree(const RandomPredicate &predicate) {
+  const std::vector<ForSomeEngine> &engines = ForSomeEngines();
+  std::vector<Bit> answers;
+  bool agree = true;
+  for (const ForSomeEngine &engine : engines) {
+    answers.push_back(engine.for_some(predicate));
+    agree &= answers.back() == answers.front();
+  }
+  if (agree) {
+    return true;
+  }
+
+  fprintf(stderr, "Engines disagree on ");
+  predicate.Print(stderr);
+  for (size_t i = 0; i < engines.size(); i++) {
+    fprintf(stderr, "  %s: %s\n", engines[i].name,
+            answers[i] ? "true" : "false");
+  }
+  return false;
+}
+
+// Generates `count` predicates from consecutive seeds and checks that the
+// engines agree on all of them.
+inline bool EnginesAgreeOnRandomPredicates(
+    const RandomPredicateOptions &options, uint64_t first_seed, int count) {
+  bool agree = true;
+  for (int i = 0; i < count; i++) {
+    RandomPredicate predicate =
+        RandomPredicate::Generate(options, first_seed + i);
+    if (!EnginesAgree(predicate)) {
+      fprintf(stderr, "  (seed %llu)\n",
+              static_cast<unsigned long long>(first_seed + i));
+      agree = false;
+    }
+  }
+  return agree;
+}
+
+#endif
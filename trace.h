@@ -0,0 +1,227 @@
+#ifndef IMPOSSIBLE_PROGRAMS_TRACE_H
+#define IMPOSSIBLE_PROGRAMS_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// A low overhead event trace for the search engines.
+//
+// Every thread records into its own fixed size ring buffer, and only that
+// thread ever writes to it, so recording an event is a timestamp and a store.
+// Tracing is switched on and off at runtime with Tracer::SetEnabled; while it
+// is off TRACE_EVENT costs a relaxed load and a branch.  WriteTrace dumps all
+// the rings in a compact binary format that trace_decode renders as text or
+// as Chrome trace-event JSON.
+
+enum class TraceEventKind : uint8_t {
+  // Payload: 0.
+  kSearchBegin,
+  // Payload: 0 for false, 1 for true and 2 if the search ran out of budget.
+  kSearchEnd,
+  // Payload: the number of indices present after the restart.
+  kRestart,
+  // Payload: the index.
+  kIndexDiscovered,
+  // Payload: 0.
+  kWitnessFound,
+  // Payload: 0.
+  kEvaluationBegin,
+  // Payload: 0 for false, 1 for true and 2 for the sentinel.
+  kEvaluationEnd,
+};
+
+constexpr int kTraceEventKindCount = 7;
+
+inline const char *TraceEventKindName(TraceEventKind kind) {
+  switch (kind) {
+  case TraceEventKind::kSearchBegin:
+    return "search_begin";
+  case TraceEventKind::kSearchEnd:
+    return "search_end";
+  case TraceEventKind::kRestart:
+    return "restart";
+  case TraceEventKind::kIndexDiscovered:
+    return "index_discovered";
+  case TraceEventKind::kWitnessFound:
+    return "witness_found";
+  case TraceEventKind::kEvaluationBegin:
+    return "evaluation_begin";
+  case TraceEventKind::kEvaluationEnd:
+    return "evaluation_end";
+  }
+  return "unknown";
+}
+
+// The on-disk and in-memory representation of an event.
+struct TraceEvent {
+  uint64_t timestamp_ns;
+  uint64_t payload;
+  uint32_t thread_id;
+  TraceEventKind kind;
+  uint8_t padding[3];
+};
+
+static_assert(sizeof(TraceEvent) == 24, "TraceEvent is part of the format");
+
+// Header of the binary trace format, followed by `event_count` TraceEvents.
+struct TraceFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t event_size;
+  uint64_t event_count;
+};
+
+constexpr char kTraceMagic[8] = {'I', 'P', 'T', 'R', 'A', 'C', 'E', '\0'};
+constexpr uint32_t kTraceVersion = 1;
+
+// The ring buffer of a single thread.  Holds the last kCapacity events.
+class TraceRing {
+public:
+  static constexpr uint64_t kCapacity = 1 << 16;
+
+  // The events are zeroed up front and Record never writes their padding, so
+  // traces do not leak whatever was in memory before.
+  explicit TraceRing(uint32_t thread_id)
+      : thread_id_(thread_id), events_(new TraceEvent[kCapacity]()) {}
+
+  // Only called by the owning thread.
+  void Record(TraceEventKind kind, uint64_t payload, uint64_t timestamp_ns) {
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    TraceEvent &event = events_[head & (kCapacity - 1)];
+    event.timestamp_ns = timestamp_ns;
+    event.payload = payload;
+    event.thread_id = thread_id_;
+    event.kind = kind;
+    head_.store(head + 1, std::memory_order_release);
+  }
+
+  // Appends the buffered events, oldest first, to `out`.  Events recorded
+  // concurrently with the copy may be torn, so dump while the owning thread
+  // is quiescent.
+  void CopyTo(std::vector<TraceEvent> *out) const {
+    uint64_t head = head_.load(std::memory_order_acquire);
+    uint64_t begin = head > kCapacity ? head - kCapacity : 0;
+    for (uint64_t i = begin; i < head; i++) {
+      out->push_back(events_[i & (kCapacity - 1)]);
+    }
+  }
+
+  void Clear() { head_.store(0, std::memory_order_release); }
+
+private:
+  uint32_t thread_id_;
+  std::atomic<uint64_t> head_{0};
+  std::unique_ptr<TraceEvent[]> events_;
+};
+
+class Tracer {
+public:
+  static bool Enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+  static void SetEnabled(bool enabled) {
+    enabled_.store(enabled, std::memory_order_relaxed);
+  }
+
+  static void Record(TraceEventKind kind, uint64_t payload) {
+    uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                       .count();
+    ThreadRing()->Record(kind, payload, now);
+  }
+
+  // Returns the events of every thread that has recorded one, grouped by
+  // thread and oldest first within a thread.
+  static std::vector<TraceEvent> Collect() {
+    std::vector<TraceEvent> events;
+    std::lock_guard<std::mutex> lock(registry_mutex_);
+    for (const std::shared_ptr<TraceRing> &ring : Registry()) {
+      ring->CopyTo(&events);
+    }
+    return events;
+  }
+
+  static void Clear() {
+    std::lock_guard<std::mutex> lock(registry_mutex_);
+    for (const std::shared_ptr<TraceRing> &ring : Registry()) {
+      ring->Clear();
+    }
+  }
+
+private:
+  static TraceRing *ThreadRing() {
+    static thread_local TraceRing *ring = nullptr;
+    if (!ring) {
+      // Rings are owned by the registry so that they outlive their thread.
+      std::lock_guard<std::mutex> lock(registry_mutex_);
+      uint32_t thread_id = Registry().size();
+      Registry().push_back(std::make_shared<TraceRing>(thread_id));
+      ring = Registry().back().get();
+    }
+    return ring;
+  }
+
+  static std::vector<std::shared_ptr<TraceRing>> &Registry() {
+    static std::vector<std::shared_ptr<TraceRing>> registry;
+    return registry;
+  }
+
+  static inline std::atomic<bool> enabled_{false};
+  static inline std::mutex registry_mutex_;
+};
+
+#define TRACE_EVENT(kind, payload)                                             \
+  do {                                                                         \
+    if (Tracer::Enabled()) {                                                   \
+      Tracer::Record(TraceEventKind::kind, (payload));                         \
+    }                                                                          \
+  } while (false)
+
+// Writes all buffered events to `out` in the binary trace format.  Returns
+// false on I/O errors.
+inline bool WriteTrace(FILE *out) {
+  std::vector<TraceEvent> events = Tracer::Collect();
+  TraceFileHeader header;
+  memcpy(header.magic, kTraceMagic, sizeof(header.magic));
+  header.version = kTraceVersion;
+  header.event_size = sizeof(TraceEvent);
+  header.event_count = events.size();
+  return fwrite(&header, sizeof(header), 1, out) == 1 &&
+         fwrite(events.data(), sizeof(TraceEvent), events.size(), out) ==
+             events.size();
+}
+
+// Reads a trace written by WriteTrace.  Returns false if `in` does not hold
+// one, including when it is too short for the event count in its header.
+// `in` must be seekable.
+inline bool ReadTrace(FILE *in, std::vector<TraceEvent> *events) {
+  TraceFileHeader header;
+  if (fread(&header, sizeof(header), 1, in) != 1 ||
+      memcmp(header.magic, kTraceMagic, sizeof(header.magic)) != 0 ||
+      header.version != kTraceVersion ||
+      header.event_size != sizeof(TraceEvent)) {
+    return false;
+  }
+
+  long start = ftell(in);
+  if (start < 0 || fseek(in, 0, SEEK_END) != 0) {
+    return false;
+  }
+  long end = ftell(in);
+  if (end < start || fseek(in, start, SEEK_SET) != 0 ||
+      header.event_count > static_cast<uint64_t>(end - start) /
+                               sizeof(TraceEvent)) {
+    return false;
+  }
+
+  events->resize(header.event_count);
+  return fread(events->data(), sizeof(TraceEvent), events->size(), in) ==
+         events->size();
+}
+
+#endif
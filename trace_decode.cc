@@ -0,0 +1,92 @@
+// Renders a trace written by main (see IMPOSSIBLE_TRACE) as text or as Chrome
+// trace-event JSON, which chrome://tracing and Perfetto can load.
+//
+// Usage: trace_decode [--chrome] <trace file>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "trace.h"
+
+namespace {
+
+void PrintText(const std::vector<TraceEvent> &events, uint64_t start_ns) {
+  for (const TraceEvent &event : events) {
+    printf("thread %3" PRIu32 " %14.3lfus %-16s %" PRIu64 "\n",
+           event.thread_id, (event.timestamp_ns - start_ns) / 1000.0,
+           TraceEventKindName(event.kind), event.payload);
+  }
+}
+
+void PrintChrome(const std::vector<TraceEvent> &events, uint64_t start_ns) {
+  printf("{\"traceEvents\": [\n");
+  for (size_t i = 0; i < events.size(); i++) {
+    const TraceEvent &event = events[i];
+    const char *name = TraceEventKindName(event.kind);
+    const char *phase = "i";
+    switch (event.kind) {
+    case TraceEventKind::kSearchBegin:
+      name = "search";
+      phase = "B";
+      break;
+    case TraceEventKind::kSearchEnd:
+      name = "search";
+      phase = "E";
+      break;
+    case TraceEventKind::kEvaluationBegin:
+      name = "predicate";
+      phase = "B";
+      break;
+    case TraceEventKind::kEvaluationEnd:
+      name = "predicate";
+      phase = "E";
+      break;
+    default:
+      break;
+    }
+
+    printf("  {\"name\": \"%s\", \"ph\": \"%s\", \"ts\": %.3lf, \"pid\": 0, "
+           "\"tid\": %" PRIu32 ", \"s\": \"t\", \"args\": {\"payload\": "
+           "%" PRIu64 "}}%s\n",
+           name, phase, (event.timestamp_ns - start_ns) / 1000.0,
+           event.thread_id, event.payload, i + 1 == events.size() ? "" : ",");
+  }
+  printf("]}\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  bool chrome = argc == 3 && strcmp(argv[1], "--chrome") == 0;
+  if (argc != 2 && !chrome) {
+    fprintf(stderr, "Usage: %s [--chrome] <trace file>\n", argv[0]);
+    return 1;
+  }
+
+  const char *path = argv[argc - 1];
+  FILE *in = fopen(path, "rb");
+  std::vector<TraceEvent> events;
+  if (!in || !ReadTrace(in, &events)) {
+    fprintf(stderr, "%s is not a trace\n", path);
+    return 1;
+  }
+  fclose(in);
+
+  uint64_t start_ns = UINT64_MAX;
+  for (const TraceEvent &event : events) {
+    if (static_cast<int>(event.kind) >= kTraceEventKindCount) {
+      fprintf(stderr, "%s is corrupt\n", path);
+      return 1;
+    }
+    start_ns = std::min(start_ns, event.timestamp_ns);
+  }
+
+  if (chrome) {
+    PrintChrome(events, start_ns);
+  } else {
+    PrintText(events, start_ns);
+  }
+}
@@ -10,43 +10,8 @@
 #define PRINT_BIT_EXPR(expr)                                                   \
   PRINT_EXPR_IMPL(expr, "%s", __val ? "true" : "false")
 
-#define PRINT_NAT_EXPR(expr) PRINT_EXPR_IMPL(expr, "%llu", __val)
-
-class Timer {
-public:
-  explicit Timer(const char *id) : id_(id) {
-    start_ = std::chrono::high_resolution_clock::now();
-  }
-
-  ~Timer() {
-    TimePointTy stop = std::chrono::high_resolution_clock::now();
-    double us =
-        std::chrono::duration_cast<std::chrono::microseconds>(stop - start_)
-            .count();
-
-    std::array<const char *, 3> unit = {"us", "ms", "s"};
-    int unit_idx;
-    for (unit_idx = 0; unit_idx < 3; unit_idx++) {
-      if (us < std::pow(1000, unit_idx)) {
-        break;
-      }
-    }
-    if (unit_idx != 0) {
-      unit_idx--;
-    }
-
-    printf("Time taken in %s: %0.3lf%s\n", id_, us / std::pow(1000, unit_idx),
-           unit[unit_idx]);
-  }
-
-private:
-  using TimePointTy =
-      std::chrono::time_point<std::chrono::high_resolution_clock>;
-  TimePointTy start_;
-  const char *id_;
-};
-
-#define CREATE_TIMER() Timer __timer(__func__);
+#define PRINT_NAT_EXPR(expr)                                                   \
+  PRINT_EXPR_IMPL(expr, "%llu", static_cast<unsigned long long>(__val))
 
 template <typename T> struct is_optional {
   static constexpr bool value = false;
@@ -90,39 +55,38 @@ template <typename T> struct is_optional<std::optional<T>> {
     var = *__tmp;                                                              \
   } while (false)
 
-#ifdef ENABLE_LOG
-#define LOG(str, ...)                                                          \
-  printf("[%s/%s:%d] " str "\n", __FILE__, __func__, __LINE__, __VA_ARGS__)
-#else
-#define LOG(str, ...) (void)0
-#endif
-
-// Used to check that we have only one active call to a function in a thread.
-// Don't use this class directly, use ASSERT_ONLY_ONE_ACTIVE_CALL instead.
-template <int *FuncId> class AssertOnlyOneActiveCall {
+// Hands out a T from a per-thread pool and returns it to the pool on
+// destruction.  Pooled objects are not reset, so containers inside them keep
+// the capacity they grew to, and code that uses them the same way every time
+// stops allocating once the pool is warm.  Callers clear the contents
+// themselves.
+template <typename T> class PooledObject {
 public:
-  explicit AssertOnlyOneActiveCall(const char *function_name) {
-    if (find_is_active_) {
-      printf("Multiple active %s frames on the same thread!\n", function_name);
-      abort();
+  PooledObject() {
+    std::vector<std::unique_ptr<T>> &free_list = FreeList();
+    if (free_list.empty()) {
+      object_ = std::make_unique<T>();
+    } else {
+      object_ = std::move(free_list.back());
+      free_list.pop_back();
     }
-
-    find_is_active_ = true;
   }
 
-  ~AssertOnlyOneActiveCall() { find_is_active_ = false; }
+  PooledObject(const PooledObject &) = delete;
+  PooledObject &operator=(const PooledObject &) = delete;
 
-private:
-  static thread_local bool find_is_active_;
-};
+  ~PooledObject() { FreeList().push_back(std::move(object_)); }
 
-template <int *FuncId>
-/*static*/ bool thread_local AssertOnlyOneActiveCall<FuncId>::find_is_active_ =
-    false;
+  T *operator->() const { return object_.get(); }
+  T &operator*() const { return *object_; }
 
-#define ASSERT_ONLY_ONE_ACTIVE_CALL()                                          \
-  static int __only_one_active_call_id;                                        \
-  AssertOnlyOneActiveCall<&__only_one_active_call_id> __only_one_active_call(  \
-      __func__);
+private:
+  static std::vector<std::unique_ptr<T>> &FreeList() {
+    static thread_local std::vector<std::unique_ptr<T>> free_list;
+    return free_list;
+  }
+
+  std::unique_ptr<T> object_;
+};
 
 #endif